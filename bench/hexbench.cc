@@ -0,0 +1,92 @@
+
+// Microbenchmark for the hex encode/decode kernels.
+//
+// usage: hexbench [FILE [ITERATIONS]]
+// FILE defaults to test/data/random.dat.
+
+#include "jup-config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "hexcodec.h"
+
+using namespace std;
+
+static bool readFile(const char *filename, vector<unsigned char>& data)
+{
+	FILE *f = fopen(filename, "rb");
+	if (!f) {
+		perror(filename);
+		return false;
+	}
+
+	unsigned char buf[65536];
+	size_t n;
+	while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+		data.insert(data.end(), buf, buf + n);
+
+	bool ok = !ferror(f);
+	fclose(f);
+	return ok;
+}
+
+static double mbPerSec(size_t bytes, unsigned int iters,
+		       chrono::steady_clock::duration d)
+{
+	double secs = chrono::duration<double>(d).count();
+	return (double) bytes * iters / (1024.0 * 1024.0) / secs;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *filename = (argc > 1) ? argv[1] : "test/data/random.dat";
+	unsigned int iters = (argc > 2) ? atoi(argv[2]) : 2000;
+
+	vector<unsigned char> data;
+	if (!readFile(filename, data) || data.empty() || iters == 0) {
+		fprintf(stderr, "hexbench: no input\n");
+		return 1;
+	}
+
+	size_t count;
+	const hexKernel *kernels = hexKernelList(count);
+
+	// reference output from the first (scalar) kernel
+	string ref(data.size() * 2, '\0');
+	kernels[0].encode(data.data(), data.size(), &ref[0]);
+
+	printf("%s: %zu bytes, %u iterations\n", filename, data.size(), iters);
+	printf("%-8s %12s %12s\n", "kernel", "enc MB/s", "dec MB/s");
+
+	int rc = 0;
+	for (size_t k = 0; k < count; k++) {
+		const hexKernel& hk = kernels[k];
+		string hex(data.size() * 2, '\0');
+		vector<unsigned char> raw(data.size());
+
+		auto t0 = chrono::steady_clock::now();
+		for (unsigned int i = 0; i < iters; i++)
+			hk.encode(data.data(), data.size(), &hex[0]);
+		auto t1 = chrono::steady_clock::now();
+		size_t n = 0;
+		for (unsigned int i = 0; i < iters; i++)
+			n = hk.decode(hex.data(), hex.size(), raw.data(),
+				      raw.size());
+		auto t2 = chrono::steady_clock::now();
+
+		if (hex != ref || n != data.size() || raw != data) {
+			fprintf(stderr, "hexbench: %s output mismatch\n",
+				hk.name);
+			rc = 1;
+		}
+
+		printf("%-8s %12.1f %12.1f\n", hk.name,
+		       mbPerSec(data.size(), iters, t1 - t0),
+		       mbPerSec(data.size(), iters, t2 - t1));
+	}
+
+	return rc;
+}
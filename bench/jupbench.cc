@@ -0,0 +1,645 @@
+
+// Benchmark suite: generates deterministic synthetic corpora, then
+// times parsing, serialization, the string encoders, and every edit
+// command run through the jup binary.  Results are written to stdout
+// as JSON, one entry per measurement, in a fixed order so that runs
+// from different releases can be diffed.
+//
+// usage: jupbench [--jup=PATH] [--size=MB] [--iterations=N] [--dir=DIR]
+// Run by "make bench".
+
+#include "jup-config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <argp.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+#include "univalue/include/univalue.h"
+#include "csv.h"
+#include "jsonwriter.h"
+#include "utf8.h"
+#include "utilstrencodings.h"
+
+using namespace std;
+
+#define PROGRAM_NAME "jupbench"
+
+const char *argp_program_version =
+PROGRAM_NAME " " VERSION;
+static const char doc[] =
+PROGRAM_NAME " - jup benchmark suite";
+
+static struct argp_option options[] = {
+	{"jup", 1001, "PATH", 0, "jup binary for the edit command timings (default ./jup).  Empty to skip them."},
+	{"size", 1002, "MB", 0, "Approximate size of each generated corpus (default 16)."},
+	{"iterations", 1003, "NUM", 0, "Runs per measurement; the fastest is reported (default 3)."},
+	{"dir", 1004, "DIR", 0, "Directory for the generated corpus files (default bench-data)."},
+
+	{ }
+};
+
+static string jupPath = "./jup";
+static size_t corpusSize = 16 * 1024 * 1024;
+static unsigned int iterations = 3;
+static string corpusDir = "bench-data";
+
+static const uint64_t CORPUS_SEED = 0x6a7570626e6368ULL;
+
+static error_t parse_opt (int key, char *arg, struct argp_state *state)
+{
+	switch(key) {
+	case 1001:
+		jupPath = arg;
+		break;
+	case 1002:
+		corpusSize = (size_t) strtoul(arg, nullptr, 10) * 1024 * 1024;
+		if (corpusSize == 0)
+			argp_error(state, "invalid --size");
+		break;
+	case 1003:
+		iterations = strtoul(arg, nullptr, 10);
+		if (iterations == 0)
+			argp_error(state, "invalid --iterations");
+		break;
+	case 1004:
+		corpusDir = arg;
+		break;
+	case ARGP_KEY_ARG:
+		argp_usage(state);
+		break;
+	default:
+		return ARGP_ERR_UNKNOWN;
+	}
+	return 0;
+}
+
+static const struct argp argp = { options, parse_opt, nullptr, doc };
+
+// xorshift64*, so that every run generates identical corpora
+class benchRng {
+private:
+	uint64_t	s;
+
+public:
+	explicit benchRng(uint64_t seed) : s(seed) {}
+
+	uint64_t next() {
+		s ^= s >> 12;
+		s ^= s << 25;
+		s ^= s >> 27;
+		return s * 2685821657736338717ULL;
+	}
+	unsigned int below(unsigned int n) { return next() % n; }
+};
+
+static void appendf(string& s, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+
+static void appendf(string& s, const char *fmt, ...)
+{
+	char buf[128];
+	va_list ap;
+	va_start(ap, fmt);
+	int n = vsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+	if (n > 0)
+		s.append(buf, (size_t) n < sizeof(buf) ? n : sizeof(buf) - 1);
+}
+
+static void genNumber(benchRng& rng, string& s)
+{
+	switch (rng.below(5)) {
+	case 0:
+		appendf(s, "%u", rng.below(1000));
+		break;
+	case 1:
+		appendf(s, "-%u", (unsigned int) rng.next());
+		break;
+	case 2:
+		appendf(s, "%llu", (unsigned long long) (rng.next() >> 1));
+		break;
+	case 3:
+		appendf(s, "%u.%02u", rng.below(100000), rng.below(100));
+		break;
+	default:
+		appendf(s, "%u.%ue%s%u", rng.below(10), rng.below(1000000),
+			rng.below(2) ? "-" : "", rng.below(300));
+		break;
+	}
+}
+
+static void genWord(benchRng& rng, string& s, unsigned int len)
+{
+	for (unsigned int i = 0; i < len; i++)
+		s.push_back('a' + rng.below(26));
+}
+
+// Nested objects and arrays, from a few levels to several hundred
+static string genDeep(size_t target)
+{
+	benchRng rng(CORPUS_SEED);
+	string s = "[";
+	for (unsigned int rec = 0; s.size() < target; rec++) {
+		if (rec)
+			s.push_back(',');
+
+		unsigned int depth = (rec % 256 == 0) ? 400 : 1 + rng.below(48);
+		string closers;
+		for (unsigned int d = 0; d < depth; d++) {
+			if (d & 1) {
+				s.push_back('[');
+				genNumber(rng, s);
+				s.push_back(',');
+				closers.push_back(']');
+			} else {
+				appendf(s, "{\"id\":%u,\"n%u\":", rec, d);
+				closers.push_back('}');
+			}
+		}
+		genNumber(rng, s);
+		s.append(closers.rbegin(), closers.rend());
+	}
+	s.push_back(']');
+	return s;
+}
+
+// One object with a great many keys
+static string genWide(size_t target)
+{
+	benchRng rng(CORPUS_SEED + 1);
+	string s = "{";
+	for (unsigned int i = 0; s.size() < target; i++) {
+		if (i)
+			s.push_back(',');
+		appendf(s, "\"k%08x\":", i);
+		switch (i % 6) {
+		case 0:
+		case 1:
+			genNumber(rng, s);
+			break;
+		case 2:
+			s.push_back('"');
+			genWord(rng, s, 4 + rng.below(24));
+			s.push_back('"');
+			break;
+		case 3:
+			s.append(rng.below(2) ? "true" : "false");
+			break;
+		case 4:
+			s.append("null");
+			break;
+		default:
+			appendf(s, "[%u,%u]", rng.below(100), rng.below(100));
+			break;
+		}
+	}
+	s.push_back('}');
+	return s;
+}
+
+// Array of strings with escapes and multi-byte UTF-8
+static string genStrings(size_t target)
+{
+	static const char *specials[] = {
+		"\\n", "\\t", "\\\"", "\\\\", "\\u00e9", "\\ud83d\\ude00",
+		"\xc3\xa9", "\xe2\x82\xac", "\xf0\x9f\x98\x80",
+	};
+	benchRng rng(CORPUS_SEED + 2);
+	string s = "[";
+	for (unsigned int i = 0; s.size() < target; i++) {
+		if (i)
+			s.push_back(',');
+		unsigned int len = (i % 100 == 0) ? 4096 : rng.below(200);
+		s.push_back('"');
+		for (unsigned int j = 0; j < len; j++) {
+			unsigned int r = rng.below(64);
+			if (r < 2)
+				s.append(specials[rng.below(ARRAYLEN(specials))]);
+			else if (r < 8)
+				s.push_back(' ');
+			else
+				s.push_back('a' + r % 26);
+		}
+		s.push_back('"');
+	}
+	s.push_back(']');
+	return s;
+}
+
+// Array of integers, decimals and exponents
+static string genNumbers(size_t target)
+{
+	benchRng rng(CORPUS_SEED + 3);
+	string s = "[";
+	for (unsigned int i = 0; s.size() < target; i++) {
+		if (i)
+			s.push_back(',');
+		genNumber(rng, s);
+	}
+	s.push_back(']');
+	return s;
+}
+
+// Header plus rows, some fields quoted with delimiters, quotes and
+// newlines inside
+static string genCsv(size_t target)
+{
+	benchRng rng(CORPUS_SEED + 4);
+	string s = "id,name,price,flag,note\n";
+	for (unsigned int i = 0; s.size() < target; i++) {
+		appendf(s, "%u,", i);
+		genWord(rng, s, 3 + rng.below(12));
+		appendf(s, ",%u.%02u,%s,", rng.below(10000), rng.below(100),
+			rng.below(2) ? "true" : "false");
+		switch (rng.below(4)) {
+		case 0:
+			s.append("\"a, \"\"quoted\"\"\nnote\"");
+			break;
+		case 1:
+			break;
+		default:
+			genWord(rng, s, rng.below(40));
+			break;
+		}
+		s.push_back('\n');
+	}
+	return s;
+}
+
+// Random bytes
+static string genBlob(size_t target)
+{
+	benchRng rng(CORPUS_SEED + 5);
+	string s(target, '\0');
+	for (size_t i = 0; i < target; i += 8) {
+		uint64_t r = rng.next();
+		memcpy(&s[i], &r, min((size_t) 8, target - i));
+	}
+	return s;
+}
+
+class benchCorpus {
+public:
+	const char	*name;
+	const char	*filename;
+	bool		json;
+	string		data;
+	string		path;
+};
+
+static bool writeFile(const string& path, const string& data)
+{
+	int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		perror(path.c_str());
+		return false;
+	}
+
+	const char *p = data.data();
+	size_t left = data.size();
+	while (left > 0) {
+		ssize_t n = write(fd, p, left);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			perror(path.c_str());
+			close(fd);
+			return false;
+		}
+		p += n;
+		left -= n;
+	}
+
+	return close(fd) == 0;
+}
+
+// bytes is the input consumed, or for serialization the output produced
+static void addResult(UniValue& results, const string& name, size_t bytes,
+		      double secs)
+{
+	char buf[32];
+	UniValue r(UniValue::VOBJ);
+	r.pushKV("name", name);
+	r.pushKV("bytes", (uint64_t) bytes);
+
+	UniValue v;
+	snprintf(buf, sizeof(buf), "%.6f", secs);
+	v.setNumStr(buf);
+	r.pushKV("seconds", v);
+
+	snprintf(buf, sizeof(buf), "%.1f",
+		 secs > 0 ? bytes / (1024.0 * 1024.0) / secs : 0.0);
+	v.setNumStr(buf);
+	r.pushKV("mb_per_sec", v);
+
+	results.push_back(r);
+}
+
+// Fastest of the configured number of runs, in seconds
+static double timeBest(const function<void()>& fn)
+{
+	double best = 0;
+	for (unsigned int i = 0; i < iterations; i++) {
+		auto t0 = chrono::steady_clock::now();
+		fn();
+		auto t1 = chrono::steady_clock::now();
+		double secs = chrono::duration<double>(t1 - t0).count();
+		if (i == 0 || secs < best)
+			best = secs;
+	}
+	return best;
+}
+
+// Run jup with args, stdin from inputPath, stdout discarded.  Returns
+// the wall-clock time, or a negative value if jup failed.
+static double runJup(const vector<string>& args, const string& inputPath)
+{
+	vector<char *> argv;
+	argv.push_back((char *) jupPath.c_str());
+	for (auto& a : args)
+		argv.push_back((char *) a.c_str());
+	argv.push_back(nullptr);
+
+	auto t0 = chrono::steady_clock::now();
+	pid_t pid = fork();
+	if (pid < 0)
+		return -1;
+	if (pid == 0) {
+		int in = open(inputPath.c_str(), O_RDONLY);
+		int out = open("/dev/null", O_WRONLY);
+		if (in < 0 || out < 0 || dup2(in, 0) < 0 || dup2(out, 1) < 0)
+			_exit(127);
+		execv(argv[0], &argv[0]);
+		_exit(127);
+	}
+
+	int status;
+	while (waitpid(pid, &status, 0) < 0)
+		if (errno != EINTR)
+			return -1;
+	auto t1 = chrono::steady_clock::now();
+
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+		return -1;
+	return chrono::duration<double>(t1 - t0).count();
+}
+
+class editBench {
+public:
+	const char		*name;
+	const char		*input;		// corpus name
+	vector<string>		args;		// corpus names in {} expanded
+};
+
+static const benchCorpus *findCorpus(const vector<benchCorpus>& corpora,
+				     const string& name)
+{
+	for (auto& c : corpora)
+		if (name == c.name)
+			return &c;
+	return nullptr;
+}
+
+static bool benchEdits(const vector<benchCorpus>& corpora, UniValue& results)
+{
+	const editBench edits[] = {
+		{ "jup/passthrough", "wide", { } },
+		{ "jup/min", "wide", { "--min" } },
+		{ "jup/get", "wide", { "get", "k00000100" } },
+		{ "jup/get.array", "wide",
+		  { "get.array", "k00000100,k00000200,k00000300" } },
+		{ "jup/get.object", "wide",
+		  { "get.object", "k00000100,k00000200,k00000300" } },
+		{ "jup/new", "wide", { "new" } },
+		{ "jup/newarray", "wide", { "newarray" } },
+		{ "jup/set", "wide", { "set", "bench", "12345" } },
+		{ "jup/str", "wide", { "str", "bench", "value" } },
+		{ "jup/int", "wide", { "int", "bench", "12345" } },
+		{ "jup/num", "wide", { "num", "bench", "1.5" } },
+		{ "jup/true", "wide", { "true", "bench" } },
+		{ "jup/false", "wide", { "false", "bench" } },
+		{ "jup/null", "wide", { "null", "bench" } },
+		{ "jup/array", "wide", { "array", "bench" } },
+		{ "jup/object", "wide", { "object", "bench" } },
+		{ "jup/file.text", "wide", { "file.text", "bench", "{csv}" } },
+		{ "jup/file.json", "wide", { "file.json", "bench", "{numbers}" } },
+		{ "jup/file.hex", "wide", { "file.hex", "bench", "{blob}" } },
+		{ "jup/file.base64", "wide", { "file.base64", "bench", "{blob}" } },
+		{ "jup/file.csv", "wide", { "file.csv", "bench", "{csv}" } },
+		{ "jup/lazy-set", "wide", { "--lazy", "set", "bench", "12345" } },
+		{ "jup/arena-set", "wide", { "--arena", "set", "bench", "12345" } },
+		{ "jup/parse-deep", "deep", { "--min" } },
+		{ "jup/parse-strings", "strings", { "--min" } },
+		{ "jup/parse-numbers", "numbers", { "--min" } },
+	};
+
+	for (auto& eb : edits) {
+		const benchCorpus *in = findCorpus(corpora, eb.input);
+		vector<string> args;
+		for (auto& a : eb.args) {
+			const benchCorpus *c = nullptr;
+			if (a.size() > 2 && a.front() == '{' && a.back() == '}')
+				c = findCorpus(corpora, a.substr(1, a.size() - 2));
+			args.push_back(c ? c->path : a);
+		}
+
+		double best = 0;
+		for (unsigned int i = 0; i < iterations; i++) {
+			double secs = runJup(args, in->path);
+			if (secs < 0) {
+				fprintf(stderr, "jupbench: %s: %s failed\n",
+					eb.name, jupPath.c_str());
+				return false;
+			}
+			if (i == 0 || secs < best)
+				best = secs;
+		}
+		addResult(results, eb.name, in->data.size(), best);
+	}
+
+	// in-place edits a fresh copy of the corpus each run
+	const benchCorpus *wide = findCorpus(corpora, "wide");
+	string copyPath = corpusDir + "/inplace.json";
+	double best = 0;
+	for (unsigned int i = 0; i < iterations; i++) {
+		if (!writeFile(copyPath, wide->data))
+			return false;
+		double secs = runJup({ "--in-place", copyPath, "set", "bench",
+				       "12345" }, "/dev/null");
+		if (secs < 0) {
+			fprintf(stderr, "jupbench: jup/in-place-set: %s failed\n",
+				jupPath.c_str());
+			return false;
+		}
+		if (i == 0 || secs < best)
+			best = secs;
+	}
+	unlink(copyPath.c_str());
+	addResult(results, "jup/in-place-set", wide->data.size(), best);
+
+	return true;
+}
+
+static bool benchJson(const vector<benchCorpus>& corpora, UniValue& results)
+{
+	for (auto& c : corpora) {
+		if (!c.json)
+			continue;
+
+		UniValue val;
+		bool ok = true;
+		double secs = timeBest([&] {
+			val = UniValue();
+			ok = ok && val.read(c.data);
+		});
+		if (!ok) {
+			fprintf(stderr, "jupbench: %s: invalid JSON\n", c.name);
+			return false;
+		}
+		addResult(results, string("parse/") + c.name, c.data.size(),
+			  secs);
+
+		string out;
+		secs = timeBest([&] {
+			out.clear();
+			writeJson(out, val, 2);
+		});
+		addResult(results, string("write-pretty/") + c.name,
+			  out.size(), secs);
+
+		secs = timeBest([&] {
+			out.clear();
+			writeJson(out, val, 0);
+		});
+		addResult(results, string("write-min/") + c.name,
+			  out.size(), secs);
+	}
+
+	return true;
+}
+
+static bool benchCodecs(const vector<benchCorpus>& corpora, UniValue& results)
+{
+	const benchCorpus *blob = findCorpus(corpora, "blob");
+	const benchCorpus *strings = findCorpus(corpora, "strings");
+	const benchCorpus *csv = findCorpus(corpora, "csv");
+	const unsigned char *raw = (const unsigned char *) blob->data.data();
+	size_t rawLen = blob->data.size();
+
+	string hex, b64, dec;
+	vector<unsigned char> bin;
+	bool ok = true;
+
+	double secs = timeBest([&] { hex = HexStr(raw, raw + rawLen); });
+	addResult(results, "codec/HexStr", rawLen, secs);
+
+	secs = timeBest([&] { ok = ok && IsHex(hex); });
+	addResult(results, "codec/IsHex", hex.size(), secs);
+
+	secs = timeBest([&] { bin = ParseHex(hex); });
+	ok = ok && bin.size() == rawLen &&
+	     memcmp(bin.data(), raw, rawLen) == 0;
+	addResult(results, "codec/ParseHex", hex.size(), secs);
+
+	secs = timeBest([&] { b64 = EncodeBase64(raw, rawLen); });
+	addResult(results, "codec/EncodeBase64", rawLen, secs);
+
+	secs = timeBest([&] { dec = DecodeBase64(b64); });
+	ok = ok && dec == blob->data;
+	addResult(results, "codec/DecodeBase64", b64.size(), secs);
+
+	secs = timeBest([&] {
+		ok = ok && is_valid_utf8(strings->data.data(),
+					 strings->data.size());
+	});
+	addResult(results, "codec/utf8-validate", strings->data.size(), secs);
+
+	size_t rows = 0;
+	secs = timeBest([&] {
+		CsvReader rdr;
+		vector<CsvField> fields;
+		ok = ok && rdr.open(csv->path);
+		rows = 0;
+		while (rdr.next(fields))
+			rows++;
+	});
+	ok = ok && rows > 1;
+	addResult(results, "codec/csv-read", csv->data.size(), secs);
+
+	if (!ok)
+		fprintf(stderr, "jupbench: codec output mismatch\n");
+	return ok;
+}
+
+int main(int argc, char *argv[])
+{
+	error_t argp_rc = argp_parse(&argp, argc, argv, 0, NULL, NULL);
+	if (argp_rc) {
+		fprintf(stderr, "%s: argp_parse failed: %s\n",
+			argv[0], strerror(argp_rc));
+		return EXIT_FAILURE;
+	}
+
+	if (mkdir(corpusDir.c_str(), 0755) < 0 && errno != EEXIST) {
+		perror(corpusDir.c_str());
+		return EXIT_FAILURE;
+	}
+
+	vector<benchCorpus> corpora = {
+		{ "deep", "deep.json", true },
+		{ "wide", "wide.json", true },
+		{ "strings", "strings.json", true },
+		{ "numbers", "numbers.json", true },
+		{ "csv", "table.csv", false },
+		{ "blob", "blob.dat", false },
+	};
+	for (auto& c : corpora) {
+		string name = c.name;
+		if (name == "deep")
+			c.data = genDeep(corpusSize);
+		else if (name == "wide")
+			c.data = genWide(corpusSize);
+		else if (name == "strings")
+			c.data = genStrings(corpusSize);
+		else if (name == "numbers")
+			c.data = genNumbers(corpusSize);
+		else if (name == "csv")
+			c.data = genCsv(corpusSize);
+		else
+			c.data = genBlob(corpusSize);
+
+		c.path = corpusDir + "/" + c.filename;
+		if (!writeFile(c.path, c.data))
+			return EXIT_FAILURE;
+	}
+
+	UniValue results(UniValue::VARR);
+	if (!benchJson(corpora, results) || !benchCodecs(corpora, results))
+		return EXIT_FAILURE;
+	if (!jupPath.empty() && !benchEdits(corpora, results))
+		return EXIT_FAILURE;
+
+	UniValue report(UniValue::VOBJ);
+	report.pushKV("version", VERSION);
+	report.pushKV("corpus_size", (uint64_t) corpusSize);
+	report.pushKV("iterations", (uint64_t) iterations);
+
+	UniValue sizes(UniValue::VOBJ);
+	for (auto& c : corpora)
+		sizes.pushKV(c.name, (uint64_t) c.data.size());
+	report.pushKV("corpora", sizes);
+	report.pushKV("results", results);
+
+	printf("%s\n", report.write(2).c_str());
+	return EXIT_SUCCESS;
+}
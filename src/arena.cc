@@ -0,0 +1,206 @@
+
+#include "jup-config.h"
+#include <new>
+#include <atomic>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#ifdef HAVE_MALLOC_USABLE_SIZE
+#include <malloc.h>
+#endif
+#include "arena.h"
+
+// Address space only: pages are committed as they are first touched.
+// When the arena fills, allocations quietly fall back to the heap.
+static const size_t ARENA_RESERVE = (size_t)1 << (sizeof(size_t) > 4 ? 38 : 30);
+static const size_t ARENA_MIN = (size_t)1 << 26;
+static const size_t ARENA_ALIGN = 16;
+
+static char *arenaBase;
+static size_t arenaSize;
+static char *arenaNext;
+static char *arenaEnd;
+static thread_local bool arenaOwner;
+static thread_local bool arenaOn;
+
+// --mem-profile counters.  Live bytes are net of frees since
+// allocProfileStart(), so may dip below zero briefly.
+static bool profileOn;
+static std::atomic<uint64_t> profAllocs;
+static std::atomic<uint64_t> profFrees;
+static std::atomic<uint64_t> profBytes;
+static std::atomic<int64_t> profLive;
+static std::atomic<int64_t> profPeak;
+
+bool arenaInit()
+{
+	if (arenaBase) {
+		arenaOwner = true;
+		return true;
+	}
+
+	for (size_t len = ARENA_RESERVE; len >= ARENA_MIN; len /= 2) {
+		void *p = mmap(nullptr, len, PROT_READ | PROT_WRITE,
+			       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+			       -1, 0);
+		if (p == MAP_FAILED)
+			continue;
+
+#ifdef MADV_HUGEPAGE
+		// fewer page faults while a large document is built
+		madvise(p, len, MADV_HUGEPAGE);
+#endif
+
+		arenaBase = arenaNext = (char *) p;
+		arenaEnd = arenaBase + len;
+		arenaSize = len;
+		arenaOwner = true;
+		return true;
+	}
+
+	return false;
+}
+
+void arenaRelease()
+{
+	if (!arenaBase)
+		return;
+
+	munmap(arenaBase, arenaSize);
+	arenaBase = arenaNext = arenaEnd = nullptr;
+	arenaSize = 0;
+	arenaOn = false;
+}
+
+ArenaScope::ArenaScope()
+	: saved(arenaOn)
+{
+	if (arenaOwner && arenaBase)
+		arenaOn = true;
+}
+
+ArenaScope::~ArenaScope()
+{
+	arenaOn = saved;
+}
+
+static inline bool inArena(void *p)
+{
+	return (uintptr_t) p - (uintptr_t) arenaBase < arenaSize;
+}
+
+void allocProfileStart()
+{
+	profAllocs = 0;
+	profFrees = 0;
+	profBytes = 0;
+	profLive = 0;
+	profPeak = 0;
+	profileOn = true;
+}
+
+void allocProfileRead(AllocStats& st)
+{
+	st.allocs = profAllocs;
+	st.frees = profFrees;
+	st.bytes = profBytes;
+	st.live = profLive > 0 ? profLive.load() : 0;
+	st.peak = profPeak;
+#ifdef HAVE_MALLOC_USABLE_SIZE
+	st.tracksLive = true;
+#else
+	st.tracksLive = false;
+#endif
+}
+
+// held is the block's real size, where known
+static void profileNew(size_t n, size_t held)
+{
+	profAllocs.fetch_add(1, std::memory_order_relaxed);
+	profBytes.fetch_add(n, std::memory_order_relaxed);
+
+	int64_t live = profLive.fetch_add(held, std::memory_order_relaxed) +
+		       held;
+	int64_t peak = profPeak.load(std::memory_order_relaxed);
+	while (live > peak &&
+	       !profPeak.compare_exchange_weak(peak, live,
+					       std::memory_order_relaxed))
+		;
+}
+
+static void profileFree(void *p)
+{
+	profFrees.fetch_add(1, std::memory_order_relaxed);
+#ifdef HAVE_MALLOC_USABLE_SIZE
+	profLive.fetch_sub(malloc_usable_size(p), std::memory_order_relaxed);
+#endif
+}
+
+static void *heapAlloc(size_t n)
+{
+	while (1) {
+		void *p = malloc(n ? n : 1);
+		if (p)
+			return p;
+
+		std::new_handler handler = std::get_new_handler();
+		if (!handler)
+			throw std::bad_alloc();
+		handler();
+	}
+}
+
+void *operator new(size_t n)
+{
+	// space left is a multiple of ARENA_ALIGN, so the rounded-up
+	// size still fits
+	if (arenaOn && n < (size_t)(arenaEnd - arenaNext)) {
+		void *p = arenaNext;
+		size_t held = n ? (n + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1) :
+				  ARENA_ALIGN;
+		arenaNext += held;
+		if (profileOn)
+			profileNew(n, held);
+		return p;
+	}
+
+	void *p = heapAlloc(n);
+	if (profileOn) {
+#ifdef HAVE_MALLOC_USABLE_SIZE
+		profileNew(n, malloc_usable_size(p));
+#else
+		profileNew(n, 0);
+#endif
+	}
+	return p;
+}
+
+void *operator new[](size_t n)
+{
+	return operator new(n);
+}
+
+void operator delete(void *p) noexcept
+{
+	// arena memory stays live until the arena is released
+	if (!inArena(p)) {
+		if (profileOn && p)
+			profileFree(p);
+		free(p);
+	}
+}
+
+void operator delete[](void *p) noexcept
+{
+	operator delete(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+	operator delete(p);
+}
+
+void operator delete[](void *p, size_t) noexcept
+{
+	operator delete(p);
+}
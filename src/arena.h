@@ -0,0 +1,50 @@
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include <stdint.h>
+
+// Bump allocator for parsed documents.  UniValue allocates through
+// the global operator new, which jup replaces: while an ArenaScope is
+// live on the thread that called arenaInit(), allocations are carved
+// from one large anonymous mapping, and operator delete of arena
+// memory is a no-op.  Nothing is reused; the whole arena is dropped
+// at once by arenaRelease().
+
+// Reserve the arena and make the calling thread its owner.  Returns
+// false (leaving every allocation on the heap) if no address space
+// could be reserved.
+extern bool arenaInit();
+
+// Unmap the arena.  No pointer into it may be used afterwards.
+extern void arenaRelease();
+
+// Route the owner thread's allocations to the arena for the lifetime
+// of the scope.  A no-op on other threads, or if arenaInit() failed.
+class ArenaScope {
+private:
+	bool	saved;
+
+public:
+	ArenaScope();
+	~ArenaScope();
+
+	ArenaScope(const ArenaScope&) = delete;
+	ArenaScope& operator=(const ArenaScope&) = delete;
+};
+
+// Allocation counts for --mem-profile, also kept by the replaced
+// operator new and delete.  Counting starts at allocProfileStart().
+class AllocStats {
+public:
+	uint64_t	allocs;
+	uint64_t	frees;
+	uint64_t	bytes;		// total requested
+	uint64_t	live;		// held now, net of frees
+	uint64_t	peak;		// most ever held at once
+	bool		tracksLive;	// live and peak are known
+};
+
+extern void allocProfileStart();
+extern void allocProfileRead(AllocStats& st);
+
+#endif // __ARENA_H__
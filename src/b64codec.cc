@@ -0,0 +1,260 @@
+
+#include "jup-config.h"
+#include <stdint.h>
+#include "b64codec.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define B64_X86 1
+#include <immintrin.h>
+#endif
+
+static const char b64chars[] =
+	"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static const signed char b64val[256] = {
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 62, -1, -1, -1, 63,
+	52, 53, 54, 55, 56, 57, 58, 59, 60, 61, -1, -1, -1, -1, -1, -1,
+	-1,  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14,
+	15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, -1, -1, -1, -1, -1,
+	-1, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40,
+	41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+};
+static void encodeScalar(const unsigned char *in, size_t len, char *out)
+{
+	size_t i = 0;
+
+	for (; i + 3 <= len; i += 3) {
+		uint32_t v = (in[i] << 16) | (in[i + 1] << 8) | in[i + 2];
+		*out++ = b64chars[v >> 18];
+		*out++ = b64chars[(v >> 12) & 63];
+		*out++ = b64chars[(v >> 6) & 63];
+		*out++ = b64chars[v & 63];
+	}
+
+	switch (len - i) {
+	case 1:
+		*out++ = b64chars[in[i] >> 2];
+		*out++ = b64chars[(in[i] & 3) << 4];
+		*out++ = '=';
+		*out++ = '=';
+		break;
+	case 2:
+		*out++ = b64chars[in[i] >> 2];
+		*out++ = b64chars[((in[i] & 3) << 4) | (in[i + 1] >> 4)];
+		*out++ = b64chars[(in[i + 1] & 15) << 2];
+		*out++ = '=';
+		break;
+	}
+}
+
+static size_t scanScalar(const char *p, size_t len)
+{
+	size_t n = 0;
+	while (n < len && b64val[(unsigned char) p[n]] >= 0)
+		n++;
+	return n;
+}
+
+static size_t decodeScalar(const char *p, size_t len, unsigned char *out)
+{
+	const unsigned char *s = (const unsigned char *) p;
+	const unsigned char *send = s + (len & ~(size_t)3);
+	unsigned char *o = out;
+
+	for (; s < send; s += 4) {
+		uint32_t v = (b64val[s[0]] << 18) | (b64val[s[1]] << 12) |
+			     (b64val[s[2]] << 6) | b64val[s[3]];
+		*o++ = v >> 16;
+		*o++ = v >> 8;
+		*o++ = v;
+	}
+
+	switch (len & 3) {
+	case 2:
+		*o++ = (b64val[s[0]] << 2) | (b64val[s[1]] >> 4);
+		break;
+	case 3:
+		*o++ = (b64val[s[0]] << 2) | (b64val[s[1]] >> 4);
+		*o++ = (b64val[s[1]] << 4) | (b64val[s[2]] >> 2);
+		break;
+	}
+
+	return o - out;
+}
+
+#ifdef B64_X86
+
+// Vector layout follows Wojciech Mula and Daniel Lemire, "Faster Base64
+// Encoding and Decoding using AVX2 Instructions" (2018).
+
+// 6-bit indices to ASCII
+__attribute__((target("avx2")))
+static inline __m256i indexToChar(__m256i idx)
+{
+	const __m256i shiftLUT = _mm256_setr_epi8(
+		'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+		'0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+		'/' - 63, 'A', 0, 0,
+		'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+		'0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+		'/' - 63, 'A', 0, 0);
+
+	__m256i r = _mm256_subs_epu8(idx, _mm256_set1_epi8(51));
+	__m256i less = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), idx);
+	r = _mm256_or_si256(r, _mm256_and_si256(less, _mm256_set1_epi8(13)));
+	return _mm256_add_epi8(_mm256_shuffle_epi8(shiftLUT, r), idx);
+}
+
+__attribute__((target("avx2")))
+static void encodeAVX2(const unsigned char *in, size_t len, char *out)
+{
+	// spread each 3-byte group over a 32-bit lane
+	const __m256i shuf = _mm256_set_epi8(
+		10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1,
+		10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+	size_t i = 0;
+
+	// 24 bytes per round, as two 16-byte loads of which 12 are used
+	for (; len - i >= 28; i += 24) {
+		__m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(
+			_mm_loadu_si128((const __m128i *)(in + i))),
+			_mm_loadu_si128((const __m128i *)(in + i + 12)), 1);
+		v = _mm256_shuffle_epi8(v, shuf);
+
+		__m256i t0 = _mm256_and_si256(v, _mm256_set1_epi32(0x0fc0fc00));
+		__m256i t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+		__m256i t2 = _mm256_and_si256(v, _mm256_set1_epi32(0x003f03f0));
+		__m256i t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+
+		_mm256_storeu_si256((__m256i *) out,
+				    indexToChar(_mm256_or_si256(t1, t3)));
+		out += 32;
+	}
+
+	encodeScalar(in + i, len - i, out);
+}
+
+// nonzero bytes of (lo & hi) mark chars outside the alphabet
+__attribute__((target("avx2")))
+static inline __m256i classify(__m256i v, __m256i *hiNibbles)
+{
+	const __m256i lutLo = _mm256_setr_epi8(
+		0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+		0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a,
+		0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+		0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+	const __m256i lutHi = _mm256_setr_epi8(
+		0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+		0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+		0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+		0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+	const __m256i mask = _mm256_set1_epi8(0x0f);
+
+	*hiNibbles = _mm256_and_si256(_mm256_srli_epi32(v, 4), mask);
+	__m256i lo = _mm256_shuffle_epi8(lutLo, _mm256_and_si256(v, mask));
+	__m256i hi = _mm256_shuffle_epi8(lutHi, *hiNibbles);
+	return _mm256_and_si256(lo, hi);
+}
+
+__attribute__((target("avx2")))
+static size_t scanAVX2(const char *p, size_t len)
+{
+	size_t i = 0;
+
+	for (; len - i >= 32; i += 32) {
+		__m256i hiNibbles;
+		__m256i bad = classify(
+			_mm256_loadu_si256((const __m256i *)(p + i)),
+			&hiNibbles);
+		uint32_t ok = _mm256_movemask_epi8(
+			_mm256_cmpeq_epi8(bad, _mm256_setzero_si256()));
+		if (ok != 0xffffffffu)
+			return i + __builtin_ctz(~ok);
+	}
+
+	return i + scanScalar(p + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static size_t decodeAVX2(const char *p, size_t len, unsigned char *out)
+{
+	const __m256i lutRoll = _mm256_setr_epi8(
+		0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+		0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+	const __m256i pack = _mm256_setr_epi8(
+		2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+		2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+	unsigned char *o = out;
+	size_t i = 0;
+
+	// 32 chars to 24 bytes per round
+	for (; len - i >= 32; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(p + i));
+		__m256i hiNibbles;
+		classify(v, &hiNibbles);	// input already validated
+
+		__m256i eq2f = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('/'));
+		__m256i roll = _mm256_shuffle_epi8(lutRoll,
+			_mm256_add_epi8(eq2f, hiNibbles));
+		v = _mm256_add_epi8(v, roll);
+
+		v = _mm256_maddubs_epi16(v, _mm256_set1_epi32(0x01400140));
+		v = _mm256_madd_epi16(v, _mm256_set1_epi32(0x00011000));
+		v = _mm256_shuffle_epi8(v, pack);
+		v = _mm256_permutevar8x32_epi32(v,
+			_mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+
+		_mm_storeu_si128((__m128i *) o, _mm256_castsi256_si128(v));
+		_mm_storel_epi64((__m128i *)(o + 16),
+				 _mm256_extracti128_si256(v, 1));
+		o += 24;
+	}
+
+	return (o - out) + decodeScalar(p + i, len - i, o);
+}
+
+#endif // B64_X86
+
+static const b64Kernel kernels[] = {
+	{ "scalar", encodeScalar, scanScalar, decodeScalar },
+#ifdef B64_X86
+	{ "avx2", encodeAVX2, scanAVX2, decodeAVX2 },
+#endif
+};
+
+const b64Kernel *b64KernelList(size_t& count)
+{
+	static const size_t nUsable = [] {
+		size_t n = sizeof(kernels) / sizeof(kernels[0]);
+#ifdef B64_X86
+		__builtin_cpu_init();
+		if (!__builtin_cpu_supports("avx2"))
+			n--;
+#endif
+		return n;
+	}();
+
+	count = nUsable;
+	return kernels;
+}
+
+const b64Kernel& b64ActiveKernel()
+{
+	static const b64Kernel *active = [] {
+		size_t n;
+		const b64Kernel *list = b64KernelList(n);
+		return &list[n - 1];
+	}();
+
+	return *active;
+}
@@ -0,0 +1,35 @@
+#ifndef __B64CODEC_H__
+#define __B64CODEC_H__
+
+#include <stddef.h>
+
+// Encode len bytes as ((len+2)/3)*4 base64 chars, with '=' padding.
+typedef void (*b64EncodeFn)(const unsigned char *in, size_t len, char *out);
+
+// Length of the leading run of base64 alphabet chars in p.
+typedef size_t (*b64ScanFn)(const char *p, size_t len);
+
+// Decode len chars, all from the base64 alphabet (no padding), into
+// out.  Returns the number of bytes written, len*3/4.
+typedef size_t (*b64DecodeFn)(const char *p, size_t len, unsigned char *out);
+
+class b64Kernel {
+public:
+	const char	*name;
+	b64EncodeFn	encode;
+	b64ScanFn	scan;
+	b64DecodeFn	decode;
+};
+
+// Fastest kernel the running CPU supports
+extern const b64Kernel& b64ActiveKernel();
+
+// All kernels usable on this CPU, slowest first (for benchmarks)
+extern const b64Kernel *b64KernelList(size_t& count);
+
+static inline size_t b64EncodedSize(size_t len)
+{
+	return (len + 2) / 3 * 4;
+}
+
+#endif // __B64CODEC_H__
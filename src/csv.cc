@@ -0,0 +1,143 @@
+
+#include "jup-config.h"
+#include <string.h>
+#include "csv.h"
+
+#if defined(__x86_64__) || defined(__SSE2__)
+#include <emmintrin.h>
+#define CSV_SSE2 1
+#endif
+
+using namespace std;
+
+bool CsvReader::open(const string& filename)
+{
+	if (!map.open(filename))
+		return false;
+
+	p = map.data();
+	end = p + map.size();
+	return true;
+}
+
+// next delimiter, quote, CR or LF at or after p
+static const char *findSpecial(const char *p, const char *end, char delim)
+{
+#ifdef CSV_SSE2
+	const __m128i vDelim = _mm_set1_epi8(delim);
+	const __m128i vQuote = _mm_set1_epi8('"');
+	const __m128i vCR = _mm_set1_epi8('\r');
+	const __m128i vLF = _mm_set1_epi8('\n');
+
+	while (end - p >= 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *) p);
+		__m128i m = _mm_or_si128(
+			_mm_or_si128(_mm_cmpeq_epi8(v, vDelim),
+				     _mm_cmpeq_epi8(v, vQuote)),
+			_mm_or_si128(_mm_cmpeq_epi8(v, vCR),
+				     _mm_cmpeq_epi8(v, vLF)));
+		int mask = _mm_movemask_epi8(m);
+		if (mask)
+			return p + __builtin_ctz(mask);
+		p += 16;
+	}
+#endif
+
+	for (; p < end; p++) {
+		char ch = *p;
+		if (ch == delim || ch == '"' || ch == '\r' || ch == '\n')
+			break;
+	}
+
+	return p;
+}
+
+bool CsvReader::next(vector<CsvField>& fields)
+{
+	fields.clear();
+	scratch.clear();
+	scratchOfs.clear();
+
+	if (p >= end)
+		return false;
+
+	bool recordDone = false;
+	while (!recordDone) {
+		// field text is one input slice until a second piece
+		// arrives, then it moves to scratch
+		const char *slice = p;
+		size_t sliceLen = 0;
+		size_t ofs = string::npos;
+		bool quoting = false;
+		bool started = false;	// had a quoted section
+
+		auto addPiece = [&](const char *s, size_t n) {
+			if (ofs != string::npos) {
+				scratch.append(s, n);
+			} else if (sliceLen == 0) {
+				slice = s;
+				sliceLen = n;
+			} else if (n > 0) {
+				ofs = scratch.size();
+				scratch.append(slice, sliceLen);
+				scratch.append(s, n);
+			}
+		};
+
+		while (true) {
+			if (quoting) {
+				started = true;
+				const char *q = (const char *)
+					memchr(p, '"', end - p);
+				if (!q) {
+					// unterminated quote runs to EOF
+					addPiece(p, end - p);
+					p = end;
+					recordDone = true;
+					break;
+				}
+				addPiece(p, q - p);
+				p = q + 1;
+				quoting = false;
+				continue;
+			}
+
+			const char *q = findSpecial(p, end, delim);
+			addPiece(p, q - p);
+			p = q;
+
+			if (p == end) {
+				recordDone = true;
+				break;
+			}
+
+			char ch = *p++;
+			if (ch == delim)
+				break;
+			if (ch == '\n') {
+				recordDone = true;
+				break;
+			}
+			if (ch == '"') {
+				// doubled quote inside quoted text
+				if (started)
+					addPiece(p - 1, 1);
+				quoting = true;
+			}
+			// CR: dropped
+		}
+
+		CsvField f;
+		f.data = slice;
+		f.len = (ofs != string::npos) ? scratch.size() - ofs : sliceLen;
+		fields.push_back(f);
+		scratchOfs.push_back(ofs);
+	}
+
+	// scratch may have moved while the record was built
+	for (size_t i = 0; i < fields.size(); i++)
+		if (scratchOfs[i] != string::npos)
+			fields[i].data = scratch.data() + scratchOfs[i];
+
+	return true;
+}
@@ -0,0 +1,43 @@
+#ifndef __CSV_H__
+#define __CSV_H__
+
+#include <string>
+#include <vector>
+#include "fileutil.h"
+
+// One field of a CSV record: a slice of the input, or of the reader's
+// scratch buffer when unescaping was needed.
+class CsvField {
+public:
+	const char	*data;
+	size_t		len;
+};
+
+// RFC 4180 reader.  Quoted fields may contain delimiters, doubled
+// quotes and newlines; rows may be any length.  Unquoted fields are
+// returned in place, and the scan for the next special character runs
+// a vector at a time.  CR outside quotes is ignored.
+class CsvReader {
+private:
+	MappedInput		map;
+	const char		*p;
+	const char		*end;
+	char			delim;
+	std::string		scratch;	// unescaped field text
+	std::vector<size_t>	scratchOfs;	// per field, or npos
+
+public:
+	CsvReader(char delim_ = ',') : p(nullptr), end(nullptr),
+		delim(delim_) {}
+
+	bool open(const std::string& filename);
+
+	// Start again from the first record
+	void rewind() { p = map.data(); }
+
+	// Parse the next record.  Field pointers are valid until the
+	// next call.  Returns false at end of input.
+	bool next(std::vector<CsvField>& fields);
+};
+
+#endif // __CSV_H__
@@ -2,32 +2,46 @@
 #include "jup-config.h"
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
 #include <vector>
 #include "fileutil.h"
 #include "utf8.h"
 
 using namespace std;
 
-static const int INPUT_BUFSIZE = 8192;
+static const size_t INPUT_BUFSIZE = 65536;
 
 bool readStringFd(int fd, string& rawBody)
 {
+	// read straight into the string's own storage, doubling as needed
+	size_t used = rawBody.size();
+
 	do {
-		vector<unsigned char> buf(INPUT_BUFSIZE);
+		if (rawBody.size() - used < INPUT_BUFSIZE)
+			rawBody.resize(max(rawBody.size() * 2,
+					   used + INPUT_BUFSIZE));
 
-		ssize_t rrc = read(fd, &buf[0], buf.size());
+		ssize_t rrc = read(fd, &rawBody[used], rawBody.size() - used);
 		if (rrc < 0) {
+			if (errno == EINTR)
+				continue;
 			perror("(stdin)");
+			rawBody.resize(used);
 			return false;
 		}
 		if (rrc == 0)
 			break;
 
-		rawBody.append((char *) &buf[0], rrc);
+		used += rrc;
 	} while (1);
 
+	rawBody.resize(used);
+
 	return true;
 }
 
@@ -49,47 +63,304 @@ bool writeStringFd(int fd, const string& rawBody)
 	return true;
 }
 
-bool readBinaryFile(const string& filename, string& body)
+bool LineReader::lineBuffered()
 {
-	int fd = open(filename.c_str(), O_RDONLY);
-	if (fd < 0) {
-		perror(filename.c_str());
+	if (scan < pos)
+		scan = pos;
+
+	if (nlPos == string::npos && scan < end) {
+		const void *nl = memchr(&buf[scan], '\n', end - scan);
+		if (nl)
+			nlPos = (const char *) nl - buf.data();
+		scan = nl ? nlPos : end;
+	}
+
+	return nlPos != string::npos;
+}
+
+bool LineReader::fill()
+{
+	// discard consumed data, grow only if one line fills the buffer
+	if (pos > 0) {
+		memmove(&buf[0], &buf[pos], end - pos);
+		end -= pos;
+		scan = (scan > pos) ? scan - pos : 0;
+		pos = 0;
+	}
+	if (buf.size() - end < INPUT_BUFSIZE / 2)
+		buf.resize(max(buf.size() * 2, INPUT_BUFSIZE));
+
+	ssize_t rrc;
+	do {
+		rrc = read(fd, &buf[end], buf.size() - end);
+	} while (rrc < 0 && errno == EINTR);
+
+	if (rrc < 0) {
+		perror("(stdin)");
+		error = true;
 		return false;
 	}
+	if (rrc == 0) {
+		eof = true;
+		return false;
+	}
+
+	end += rrc;
+	total += rrc;
+	return true;
+}
 
-	bool rc = readStringFd(fd, body);
-	close(fd);
+bool LineReader::getline(const char *& line, size_t& lineLen)
+{
+	while (!lineBuffered()) {
+		if (eof || error || !fill()) {
+			if (error || pos >= end)
+				return false;
 
-	return rc;
+			// final line lacks a trailing newline
+			line = &buf[pos];
+			lineLen = end - pos;
+			pos = end;
+			return true;
+		}
+	}
+
+	line = &buf[pos];
+	lineLen = nlPos - pos;
+	pos = nlPos + 1;
+	nlPos = string::npos;
+
+	return true;
 }
 
-bool readTextFile(const string& filename, string& body)
+bool MappedInput::openFd(int fd, const string& name)
 {
-	bool rc = readBinaryFile(filename, body);
-	if (!rc)
+	close();
+
+	struct stat st;
+	if (fstat(fd, &st) < 0) {
+		perror(name.c_str());
 		return false;
+	}
+
+	if (S_ISREG(st.st_mode) && st.st_size > 0) {
+		// honor any data already consumed from the fd
+		off_t cur = lseek(fd, 0, SEEK_CUR);
+		if (cur < 0)
+			cur = 0;
+
+		if (cur >= st.st_size) {
+			ptr = "";
+			len = 0;
+			return true;
+		}
+
+		off_t pageMask = sysconf(_SC_PAGESIZE) - 1;
+		off_t mapOff = cur & ~pageMask;
+
+		mapLen = st.st_size - mapOff;
+		void *p = mmap(nullptr, mapLen, PROT_READ, MAP_PRIVATE,
+			       fd, mapOff);
+		if (p != MAP_FAILED) {
+			madvise(p, mapLen, MADV_SEQUENTIAL);
+			mapBase = p;
+			ptr = (const char *) p + (cur - mapOff);
+			len = st.st_size - cur;
+			return true;
+		}
+
+		// fall through to read(2) on mmap failure
+		mapLen = 0;
+	}
+
+	if (!readStringFd(fd, buf))
+		return false;
+
+	ptr = buf.data();
+	len = buf.size();
+
+	return true;
+}
+
+static bool writeAll(int fd, const char *p, size_t n, const string& name)
+{
+	while (n > 0) {
+		ssize_t wrc = write(fd, p, n);
+		if (wrc < 0) {
+			if (errno == EINTR)
+				continue;
+			perror(name.c_str());
+			return false;
+		}
+
+		p += wrc;
+		n -= wrc;
+	}
 
-	return is_valid_utf8(body.c_str());
+	return true;
 }
 
-bool readTextLines(const std::string& filename, std::vector<std::string>& lines)
+// Append len bytes of srcFd, starting at off, to dstFd
+static bool copyRange(int srcFd, off_t off, size_t len, int dstFd,
+		      const string& name)
 {
-	RFile f;
+#ifdef HAVE_COPY_FILE_RANGE
+	while (len > 0) {
+		ssize_t n = copy_file_range(srcFd, &off, dstFd, nullptr,
+					    len, 0);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;		// not supported here: copy by hand
+
+		len -= n;
+	}
+#endif
+
+	vector<char> buf(min(len, INPUT_BUFSIZE));
 
-	if (!f.open(filename, "r")) {
+	while (len > 0) {
+		ssize_t rrc = pread(srcFd, &buf[0], min(len, buf.size()), off);
+		if (rrc < 0 && errno == EINTR)
+			continue;
+		if (rrc < 0) {
+			perror(name.c_str());
+			return false;
+		}
+		if (rrc == 0) {
+			fprintf(stderr, "%s: file truncated\n", name.c_str());
+			return false;
+		}
+		if (!writeAll(dstFd, &buf[0], rrc, name))
+			return false;
+
+		off += rrc;
+		len -= rrc;
+	}
+
+	return true;
+}
+
+bool spliceFile(const string& filename, const vector<FileSplice>& splices)
+{
+	int fd = ::open(filename.c_str(), O_RDONLY);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) < 0) {
 		perror(filename.c_str());
+		if (fd >= 0)
+			::close(fd);
 		return false;
 	}
 
-	string line;
-	while (f.getline(line))
-		lines.push_back(line);
+	// same directory, so the rename cannot cross filesystems
+	string tmpName = filename + ".XXXXXX";
+	int tmpFd = mkstemp(&tmpName[0]);
+	if (tmpFd < 0) {
+		perror(tmpName.c_str());
+		::close(fd);
+		return false;
+	}
+
+	bool ok = true;
+	if (fchmod(tmpFd, st.st_mode & 07777) < 0) {
+		perror(tmpName.c_str());
+		ok = false;
+	}
+
+	off_t pos = 0;
+	for (const FileSplice& sp : splices) {
+		if (!ok)
+			break;
+
+		ok = copyRange(fd, pos, sp.offset - pos, tmpFd, filename) &&
+		     writeAll(tmpFd, sp.text.data(), sp.text.size(), tmpName);
+		pos = sp.offset + sp.len;
+	}
+
+	if (ok)
+		ok = copyRange(fd, pos, st.st_size - pos, tmpFd, filename);
 
-	if (f.haveError()) {
+	if (ok && fsync(tmpFd) < 0) {
+		perror(tmpName.c_str());
+		ok = false;
+	}
+	if (::close(tmpFd) < 0 && ok) {
+		perror(tmpName.c_str());
+		ok = false;
+	}
+	::close(fd);
+
+	if (ok && rename(tmpName.c_str(), filename.c_str()) < 0) {
 		perror(filename.c_str());
+		ok = false;
+	}
+	if (!ok) {
+		unlink(tmpName.c_str());
 		return false;
 	}
 
+	// make the rename itself durable
+	size_t slash = filename.rfind('/');
+	string dir = (slash == string::npos) ? "." :
+		     (slash == 0) ? "/" : filename.substr(0, slash);
+	int dirFd = ::open(dir.c_str(), O_RDONLY);
+	if (dirFd >= 0) {
+		fsync(dirFd);
+		::close(dirFd);
+	}
+
 	return true;
 }
 
+bool MappedInput::open(const string& filename)
+{
+	int fd = ::open(filename.c_str(), O_RDONLY);
+	if (fd < 0) {
+		perror(filename.c_str());
+		return false;
+	}
+
+	bool rc = openFd(fd, filename);
+	::close(fd);		// mapping outlives the descriptor
+
+	return rc;
+}
+
+void MappedInput::close()
+{
+	if (mapBase) {
+		munmap(mapBase, mapLen);
+		mapBase = nullptr;
+		mapLen = 0;
+	}
+
+	buf.clear();
+	buf.shrink_to_fit();
+	ptr = nullptr;
+	len = 0;
+}
+
+bool readBinaryFile(const string& filename, string& body)
+{
+	MappedInput in;
+	if (!in.open(filename))
+		return false;
+
+	body.assign(in.data(), in.size());
+
+	return true;
+}
+
+bool readTextFile(const string& filename, string& body)
+{
+	bool rc = readBinaryFile(filename, body);
+	if (!rc)
+		return false;
+
+	if (!is_valid_utf8(body.data(), body.size())) {
+		fprintf(stderr, "%s: file not UTF8\n", filename.c_str());
+		return false;
+	}
+
+	return true;
+}
@@ -5,6 +5,7 @@
 #include <vector>
 #include <cassert>
 #include <cstdio>
+#include <cstdint>
 
 class RFile {
 private:
@@ -65,20 +66,96 @@ public:
 
 		char linebuf[1024];
 
-		char *rc = fgets(linebuf, sizeof(linebuf), f);
-		if (!rc)
-			return false;
-
-		line.assign(rc);
+		// lines longer than linebuf arrive in several pieces
+		line.clear();
+		while (fgets(linebuf, sizeof(linebuf), f)) {
+			line.append(linebuf);
+			if (line.back() == '\n')
+				return true;
+		}
 
-		return true;
+		return !line.empty();
 	}
 };
 
+// Read-only view of an entire input source.  Regular files are mmap'd
+// and parsed in place; pipes, ttys and sockets fall back to a single
+// growable buffer.
+class MappedInput {
+private:
+	void		*mapBase;
+	size_t		mapLen;
+	std::string	buf;
+	const char	*ptr;
+	size_t		len;
+
+public:
+	MappedInput() : mapBase(nullptr), mapLen(0), ptr(nullptr), len(0) {}
+	~MappedInput() { close(); }
+
+	MappedInput(const MappedInput&) = delete;
+	MappedInput& operator=(const MappedInput&) = delete;
+
+	bool openFd(int fd, const std::string& name);
+	bool open(const std::string& filename);
+	void close();
+
+	const char *data() const { return ptr; }
+	size_t size() const { return len; }
+	bool mapped() const { return mapBase != nullptr; }
+};
+
+// Incremental newline-delimited reader.  Memory use is bounded by the
+// longest line, not by the size of the input.
+class LineReader {
+private:
+	int		fd;
+	std::string	buf;
+	size_t		pos;		// start of unconsumed data
+	size_t		end;		// end of valid data
+	size_t		scan;		// [pos, scan) known newline-free
+	size_t		nlPos;		// cached newline position, or npos
+	bool		eof;
+	bool		error;
+	uint64_t	total;		// bytes read so far
+
+	bool fill();
+
+public:
+	LineReader(int fd_) : fd(fd_), pos(0), end(0), scan(0),
+		nlPos(std::string::npos), eof(false), error(false),
+		total(0) {}
+
+	// Return next line, excluding the newline.  Pointer is valid
+	// until the next call.  Returns false at EOF or on error.
+	bool getline(const char *& line, size_t& lineLen);
+
+	// True if another complete line is available without read(2)
+	bool lineBuffered();
+
+	bool haveError() const { return error; }
+	uint64_t bytesRead() const { return total; }
+};
+
+// One change to a file being rewritten: bytes [offset, offset + len)
+// of the original are replaced by text (len 0 inserts).
+class FileSplice {
+public:
+	size_t		offset;
+	size_t		len;
+	std::string	text;
+};
+
+// Rewrite filename with splices (sorted, non-overlapping) applied.
+// Unchanged ranges are copied by the kernel, sharing extents where
+// the filesystem supports it; the new file is synced, then renamed
+// over the original.
+extern bool spliceFile(const std::string& filename,
+		       const std::vector<FileSplice>& splices);
+
 extern bool readStringFd(int fd, std::string& rawBody);
 extern bool writeStringFd(int fd, const std::string& rawBody);
 extern bool readBinaryFile(const std::string& filename, std::string& body);
 extern bool readTextFile(const std::string& filename, std::string& body);
-extern bool readTextLines(const std::string& filename, std::vector<std::string>& lines);
 
 #endif // __FILEUTIL_H__
@@ -0,0 +1,265 @@
+
+#include "jup-config.h"
+#include <stdint.h>
+#include "hexcodec.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define HEX_X86 1
+#include <immintrin.h>
+#endif
+
+static const char hexmap[16] = {
+	'0', '1', '2', '3', '4', '5', '6', '7',
+	'8', '9', 'a', 'b', 'c', 'd', 'e', 'f'
+};
+
+static const signed char hexval[256] = {
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	 0,  1,  2,  3,  4,  5,  6,  7,  8,  9, -1, -1, -1, -1, -1, -1,
+	-1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+};
+
+static void encodeScalar(const unsigned char *in, size_t len, char *out)
+{
+	for (size_t i = 0; i < len; i++) {
+		*out++ = hexmap[in[i] >> 4];
+		*out++ = hexmap[in[i] & 15];
+	}
+}
+
+static size_t decodeScalar(const char *p, size_t len,
+			   unsigned char *out, size_t outLen)
+{
+	size_t pairs = len / 2;
+	if (pairs > outLen)
+		pairs = outLen;
+
+	for (size_t i = 0; i < pairs; i++) {
+		int hi = hexval[(unsigned char) p[i * 2]];
+		int lo = hexval[(unsigned char) p[i * 2 + 1]];
+		if ((hi | lo) < 0)
+			return i;
+		if (out)
+			out[i] = (hi << 4) | lo;
+	}
+
+	return pairs;
+}
+
+#ifdef HEX_X86
+
+// nibbles (0-15) to ASCII hex digits
+static inline __m128i nibbleToHex128(__m128i n)
+{
+	__m128i gt9 = _mm_cmpgt_epi8(n, _mm_set1_epi8(9));
+	__m128i c = _mm_add_epi8(n, _mm_set1_epi8('0'));
+	return _mm_add_epi8(c, _mm_and_si128(gt9, _mm_set1_epi8('a' - '0' - 10)));
+}
+
+// ASCII hex digits to nibbles; lanes of *valid are 0xff where digit
+static inline __m128i hexToNibble128(__m128i c, __m128i *valid)
+{
+	__m128i l = _mm_or_si128(c, _mm_set1_epi8(0x20));
+	__m128i isDigit = _mm_and_si128(
+		_mm_cmpgt_epi8(c, _mm_set1_epi8('0' - 1)),
+		_mm_cmplt_epi8(c, _mm_set1_epi8('9' + 1)));
+	__m128i isAlpha = _mm_and_si128(
+		_mm_cmpgt_epi8(l, _mm_set1_epi8('a' - 1)),
+		_mm_cmplt_epi8(l, _mm_set1_epi8('f' + 1)));
+	*valid = _mm_or_si128(isDigit, isAlpha);
+	return _mm_or_si128(
+		_mm_and_si128(isDigit, _mm_sub_epi8(c, _mm_set1_epi8('0'))),
+		_mm_and_si128(isAlpha, _mm_sub_epi8(l, _mm_set1_epi8('a' - 10))));
+}
+
+// 16-bit lanes of (hi, lo) nibble pairs to byte values in 16-bit lanes
+static inline __m128i joinNibbles128(__m128i n)
+{
+	__m128i hi = _mm_and_si128(n, _mm_set1_epi16(0x00ff));
+	return _mm_or_si128(_mm_slli_epi16(hi, 4), _mm_srli_epi16(n, 8));
+}
+
+static void encodeSSE2(const unsigned char *in, size_t len, char *out)
+{
+	const __m128i mask = _mm_set1_epi8(0x0f);
+	size_t i = 0;
+
+	for (; i + 16 <= len; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(in + i));
+		__m128i hi = nibbleToHex128(
+			_mm_and_si128(_mm_srli_epi16(v, 4), mask));
+		__m128i lo = nibbleToHex128(_mm_and_si128(v, mask));
+		_mm_storeu_si128((__m128i *)(out + i * 2),
+				 _mm_unpacklo_epi8(hi, lo));
+		_mm_storeu_si128((__m128i *)(out + i * 2 + 16),
+				 _mm_unpackhi_epi8(hi, lo));
+	}
+
+	encodeScalar(in + i, len - i, out + i * 2);
+}
+
+static size_t decodeSSE2(const char *p, size_t len,
+			 unsigned char *out, size_t outLen)
+{
+	size_t pairs = len / 2;
+	if (pairs > outLen)
+		pairs = outLen;
+	size_t i = 0;
+
+	for (; i + 16 <= pairs; i += 16) {
+		__m128i va, vb;
+		__m128i a = hexToNibble128(
+			_mm_loadu_si128((const __m128i *)(p + i * 2)), &va);
+		__m128i b = hexToNibble128(
+			_mm_loadu_si128((const __m128i *)(p + i * 2 + 16)), &vb);
+		if (_mm_movemask_epi8(_mm_and_si128(va, vb)) != 0xffff)
+			break;		// scalar finds the exact stop
+		if (out)
+			_mm_storeu_si128((__m128i *)(out + i),
+				_mm_packus_epi16(joinNibbles128(a),
+						 joinNibbles128(b)));
+	}
+
+	return i + decodeScalar(p + i * 2, (pairs - i) * 2,
+				out ? out + i : nullptr, pairs - i);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i nibbleToHex256(__m256i n)
+{
+	__m256i gt9 = _mm256_cmpgt_epi8(n, _mm256_set1_epi8(9));
+	__m256i c = _mm256_add_epi8(n, _mm256_set1_epi8('0'));
+	return _mm256_add_epi8(c,
+		_mm256_and_si256(gt9, _mm256_set1_epi8('a' - '0' - 10)));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i hexToNibble256(__m256i c, __m256i *valid)
+{
+	__m256i l = _mm256_or_si256(c, _mm256_set1_epi8(0x20));
+	__m256i isDigit = _mm256_andnot_si256(
+		_mm256_cmpgt_epi8(_mm256_set1_epi8('0'), c),
+		_mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), c));
+	__m256i isAlpha = _mm256_andnot_si256(
+		_mm256_cmpgt_epi8(_mm256_set1_epi8('a'), l),
+		_mm256_cmpgt_epi8(_mm256_set1_epi8('f' + 1), l));
+	*valid = _mm256_or_si256(isDigit, isAlpha);
+	return _mm256_or_si256(
+		_mm256_and_si256(isDigit,
+			_mm256_sub_epi8(c, _mm256_set1_epi8('0'))),
+		_mm256_and_si256(isAlpha,
+			_mm256_sub_epi8(l, _mm256_set1_epi8('a' - 10))));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i joinNibbles256(__m256i n)
+{
+	__m256i hi = _mm256_and_si256(n, _mm256_set1_epi16(0x00ff));
+	return _mm256_or_si256(_mm256_slli_epi16(hi, 4),
+			       _mm256_srli_epi16(n, 8));
+}
+
+__attribute__((target("avx2")))
+static void encodeAVX2(const unsigned char *in, size_t len, char *out)
+{
+	const __m256i mask = _mm256_set1_epi8(0x0f);
+	size_t i = 0;
+
+	for (; i + 32 <= len; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(in + i));
+		__m256i hi = nibbleToHex256(
+			_mm256_and_si256(_mm256_srli_epi16(v, 4), mask));
+		__m256i lo = nibbleToHex256(_mm256_and_si256(v, mask));
+
+		// unpack works per 128-bit lane; swap the middle halves
+		__m256i a = _mm256_unpacklo_epi8(hi, lo);
+		__m256i b = _mm256_unpackhi_epi8(hi, lo);
+		_mm256_storeu_si256((__m256i *)(out + i * 2),
+				    _mm256_permute2x128_si256(a, b, 0x20));
+		_mm256_storeu_si256((__m256i *)(out + i * 2 + 32),
+				    _mm256_permute2x128_si256(a, b, 0x31));
+	}
+
+	encodeSSE2(in + i, len - i, out + i * 2);
+}
+
+__attribute__((target("avx2")))
+static size_t decodeAVX2(const char *p, size_t len,
+			 unsigned char *out, size_t outLen)
+{
+	size_t pairs = len / 2;
+	if (pairs > outLen)
+		pairs = outLen;
+	size_t i = 0;
+
+	for (; i + 32 <= pairs; i += 32) {
+		__m256i va, vb;
+		__m256i a = hexToNibble256(
+			_mm256_loadu_si256((const __m256i *)(p + i * 2)), &va);
+		__m256i b = hexToNibble256(
+			_mm256_loadu_si256((const __m256i *)(p + i * 2 + 32)),
+			&vb);
+		if (_mm256_movemask_epi8(_mm256_and_si256(va, vb)) != -1)
+			break;
+		if (out) {
+			// pack works per 128-bit lane; restore byte order
+			__m256i v = _mm256_packus_epi16(joinNibbles256(a),
+							joinNibbles256(b));
+			_mm256_storeu_si256((__m256i *)(out + i),
+					    _mm256_permute4x64_epi64(v, 0xd8));
+		}
+	}
+
+	return i + decodeSSE2(p + i * 2, (pairs - i) * 2,
+			      out ? out + i : nullptr, pairs - i);
+}
+
+#endif // HEX_X86
+
+static const hexKernel kernels[] = {
+	{ "scalar", encodeScalar, decodeScalar },
+#ifdef HEX_X86
+	{ "sse2", encodeSSE2, decodeSSE2 },
+	{ "avx2", encodeAVX2, decodeAVX2 },
+#endif
+};
+
+const hexKernel *hexKernelList(size_t& count)
+{
+	static const size_t nUsable = [] {
+		size_t n = sizeof(kernels) / sizeof(kernels[0]);
+#ifdef HEX_X86
+		__builtin_cpu_init();
+		if (!__builtin_cpu_supports("avx2"))
+			n--;
+#endif
+		return n;
+	}();
+
+	count = nUsable;
+	return kernels;
+}
+
+const hexKernel& hexActiveKernel()
+{
+	static const hexKernel *active = [] {
+		size_t n;
+		const hexKernel *list = hexKernelList(n);
+		return &list[n - 1];
+	}();
+
+	return *active;
+}
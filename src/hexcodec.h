@@ -0,0 +1,39 @@
+#ifndef __HEXCODEC_H__
+#define __HEXCODEC_H__
+
+#include <stddef.h>
+
+// Encode len bytes as 2*len lowercase hex digits.
+typedef void (*hexEncodeFn)(const unsigned char *in, size_t len, char *out);
+
+// Decode up to min(len/2, outLen) whitespace-free hex digit pairs,
+// stopping before the first pair with a non-hex digit.  Returns the
+// number of bytes decoded.  out may be null to only count.
+typedef size_t (*hexDecodeFn)(const char *p, size_t len,
+			      unsigned char *out, size_t outLen);
+
+class hexKernel {
+public:
+	const char	*name;
+	hexEncodeFn	encode;
+	hexDecodeFn	decode;
+};
+
+// Fastest kernel the running CPU supports
+extern const hexKernel& hexActiveKernel();
+
+// All kernels usable on this CPU, slowest first (for benchmarks)
+extern const hexKernel *hexKernelList(size_t& count);
+
+static inline void hexEncode(const unsigned char *in, size_t len, char *out)
+{
+	hexActiveKernel().encode(in, len, out);
+}
+
+static inline size_t hexDecode(const char *p, size_t len,
+			       unsigned char *out, size_t outLen)
+{
+	return hexActiveKernel().decode(p, len, out, outLen);
+}
+
+#endif // __HEXCODEC_H__
@@ -0,0 +1,189 @@
+
+#include "jup-config.h"
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <algorithm>
+#include <mutex>
+#include <unordered_set>
+#include "jpath.h"
+#include "utf8.h"
+
+using namespace std;
+
+static mutex internLock;
+static unordered_set<string> internPool;
+
+const string *internString(const string& s)
+{
+	lock_guard<mutex> lk(internLock);
+
+	// set elements never move, so the pointer outlives rehashing
+	return &*internPool.insert(s).first;
+}
+
+void internClear()
+{
+	lock_guard<mutex> lk(internLock);
+	internPool.clear();
+}
+
+static bool isDigitSeg(const char *p, size_t len)
+{
+	for (size_t i = 0; i < len; i++)
+		if (!isdigit(p[i]))
+			return false;
+
+	return true;
+}
+
+// An optional "-?digits" bound at p, which is left past it
+static bool parseBound(const char *& p, const char *end, bool& has, long& v)
+{
+	const char *q = p;
+	if (q < end && *q == '-')
+		q++;
+
+	const char *digits = q;
+	while (q < end && isdigit(*q))
+		q++;
+
+	has = (q > digits);
+	if (!has)
+		return q == p;		// a lone '-' is no bound
+
+	// out of range clamps to LONG_MIN/LONG_MAX, which acts the same
+	v = strtol(string(p, q - p).c_str(), NULL, 10);
+	p = q;
+	return true;
+}
+
+// "start:end" or "start:end:step", each part optional
+static bool parseSlice(const char *p, size_t len, jpathSlice& slice)
+{
+	const char *end = p + len;
+
+	if (!parseBound(p, end, slice.hasStart, slice.start) ||
+	    p == end || *p++ != ':' ||
+	    !parseBound(p, end, slice.hasEnd, slice.end))
+		return false;
+
+	bool hasStep = false;
+	if (p < end &&
+	    (*p++ != ':' || !parseBound(p, end, hasStep, slice.step) ||
+	     p < end))
+		return false;
+	if (!hasStep)
+		slice.step = 1;
+
+	return slice.step != 0;
+}
+
+static long clampBound(long v, long len, long lo, long hi)
+{
+	if (v < 0)
+		v += len;
+	return v < lo ? lo : (v > hi ? hi : v);
+}
+
+void jpathSlice::bounds(size_t len, size_t& first, size_t& count) const
+{
+	long n = (long) len;
+	long from, to;
+	unsigned long stride;
+
+	if (step > 0) {
+		from = hasStart ? clampBound(start, n, 0, n) : 0;
+		to = hasEnd ? clampBound(end, n, 0, n) : n;
+		stride = step;
+	} else {
+		// walking down, to stops short of it; -1 is past index 0
+		from = hasStart ? clampBound(start, n, -1, n - 1) : n - 1;
+		to = hasEnd ? clampBound(end, n, -1, n - 1) : -1;
+		stride = 0UL - (unsigned long) step;
+		swap(from, to);
+	}
+
+	count = (to > from) ? (unsigned long) (to - from - 1) / stride + 1 : 0;
+	first = (step > 0) ? from : to;
+}
+
+bool JsonPath::compile(const string& path)
+{
+	segs.clear();
+
+	valid = is_valid_utf8(path.data(), path.size());
+	if (!valid)
+		return false;
+
+	// split on '.', skipping empty segments
+	size_t pos = 0;
+	while (pos < path.size()) {
+		size_t dot = path.find('.', pos);
+		if (dot == string::npos)
+			dot = path.size();
+
+		if (dot > pos) {
+			jpathSeg seg;
+			seg.key = internString(path.substr(pos, dot - pos));
+			seg.isIndex = isDigitSeg(&path[pos], dot - pos);
+			seg.index = 0;
+			if (seg.isIndex) {
+				errno = 0;
+				seg.index = strtoul(seg.key->c_str(), NULL, 10);
+				if (errno == ERANGE)
+					seg.index = ULONG_MAX;
+			}
+			seg.isSlice = !seg.isIndex &&
+				parseSlice(&path[pos], dot - pos, seg.slice);
+
+			segs.push_back(seg);
+		}
+
+		pos = dot + 1;
+	}
+
+	return true;
+}
+
+void JsonPath::append(const JsonPath& other)
+{
+	segs.insert(segs.end(), other.segs.begin(), other.segs.end());
+	valid = valid && other.valid;
+}
+
+PathTrie::PathTrie()
+{
+	nodes.resize(1);
+	nodes[0].parent = 0;
+	nodes[0].terminal = false;
+}
+
+size_t PathTrie::add(const JsonPath& path)
+{
+	size_t n = 0;
+
+	for (const jpathSeg& seg : path.segs) {
+		auto it = nodes[n].byKey.find(*seg.key);
+		if (it != nodes[n].byKey.end()) {
+			n = it->second;
+			continue;
+		}
+
+		size_t c = nodes.size();
+		nodes.resize(c + 1);
+		nodes[c].seg = seg;
+		nodes[c].parent = n;
+		nodes[c].terminal = false;
+
+		nodes[n].children.push_back(c);
+		nodes[n].byKey[*seg.key] = c;
+		if (seg.isIndex)
+			nodes[n].byIndex.insert(make_pair(seg.index, c));
+		n = c;
+	}
+
+	nodes[n].terminal = true;
+	return n;
+}
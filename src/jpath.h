@@ -0,0 +1,88 @@
+#ifndef __JPATH_H__
+#define __JPATH_H__
+
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+
+// Array slice "start:end:step", with Python semantics: omitted bounds
+// span the whole array, and negative ones count from its end.
+class jpathSlice {
+public:
+	bool	hasStart, hasEnd;
+	long	start, end, step;	// step is never 0
+
+	// Resolve against an array of len elements: the slice selects
+	// count elements, first, first + step, ...
+	void bounds(size_t len, size_t& first, size_t& count) const;
+
+	// Ascending, with no bound counting from the end: elements can be
+	// selected without knowing the array's length.
+	bool forward() const {
+		return step > 0 && (!hasStart || start >= 0) &&
+		       (!hasEnd || end >= 0);
+	}
+};
+
+// One segment of a compiled JSON path.  Key text is interned, and a
+// segment made only of digits also carries its decoded array index.
+// A segment in slice form is a slice when it ends a "get" path on an
+// array, and an ordinary key otherwise.
+class jpathSeg {
+public:
+	const std::string	*key;
+	unsigned long		index;
+	bool			isIndex;
+	bool			isSlice;
+	jpathSlice		slice;
+};
+
+// A JSON-PATH ("a.b.0.c"), validated and split into segments once so
+// that repeated lookups do no string parsing.
+class JsonPath {
+public:
+	std::vector<jpathSeg>	segs;
+	bool			valid;		// path was valid UTF-8
+
+	JsonPath() : valid(false) {}
+
+	bool compile(const std::string& path);
+	void append(const JsonPath& other);
+
+	bool empty() const { return segs.empty(); }
+	size_t size() const { return segs.size(); }
+	bool sliced() const { return !segs.empty() && segs.back().isSlice; }
+	const jpathSeg& operator[](size_t i) const { return segs[i]; }
+};
+
+// Several paths merged on their shared prefixes, so that one walk of a
+// document resolves them all.  Node 0 is the root (the empty path);
+// every other node is reached from its parent by one segment.
+class PathTrie {
+public:
+	class node {
+	public:
+		jpathSeg	seg;		// segment leading here
+		size_t		parent;
+		bool		terminal;	// a path ends here
+		std::vector<size_t>	children;
+		std::unordered_map<std::string, size_t>	byKey;
+		std::multimap<unsigned long, size_t>	byIndex;
+	};
+
+	std::vector<node>	nodes;
+
+	PathTrie();
+
+	// Merge in a (valid, non-empty) path.  Returns its end node.
+	size_t add(const JsonPath& path);
+};
+
+// Return a stable pointer to the canonical copy of s
+extern const std::string *internString(const std::string& s);
+
+// Drop every interned string.  No compiled path may outlive this.
+extern void internClear();
+
+#endif // __JPATH_H__
@@ -0,0 +1,798 @@
+
+#include "jup-config.h"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include "univalue/include/univalue.h"
+#include "jsonscan.h"
+#include "utf8.h"
+
+using namespace std;
+
+static const size_t SCAN_BUFSIZE = 65536;
+static const size_t MAX_JSON_DEPTH = 512;
+
+bool JsonScanner::openFd(int fd_, const string& name)
+{
+	fd = fd_;
+
+	struct stat st;
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+		// whole input is one window; pages are touched only as
+		// far as the scan proceeds
+		if (!map.openFd(fd, name))
+			return false;
+
+		base = p = map.data();
+		e = p + map.size();
+		eof = true;
+		return true;
+	}
+
+	buf.resize(SCAN_BUFSIZE);
+	base = p = e = buf.data();
+	return true;
+}
+
+bool JsonScanner::refill()
+{
+	if (eof)
+		return false;
+
+	if (capture)
+		capture->append(capStart, e - capStart);
+	passed += e - base;
+
+	ssize_t rrc;
+	do {
+		rrc = read(fd, &buf[0], buf.size());
+	} while (rrc < 0 && errno == EINTR);
+
+	if (rrc < 0)
+		perror("(stdin)");
+	if (rrc <= 0) {
+		eof = true;
+		p = e = capStart = buf.data();
+		return false;
+	}
+
+	p = capStart = buf.data();
+	e = p + rrc;
+	return true;
+}
+
+int JsonScanner::skipWs()
+{
+	while (1) {
+		int c = peek();
+		if (c != ' ' && c != '\t' && c != '\n' && c != '\r')
+			return c;
+		p++;
+	}
+}
+
+// opening quote already consumed.  Escapes, control characters and
+// UTF-8 are checked as the JSON parser would.
+bool JsonScanner::skipString()
+{
+	while (1) {
+		while (p < e) {
+			unsigned char c = *p;
+			if (c == '"') {
+				p++;
+				return true;
+			}
+			if (c < 0x20)
+				return false;
+			if (c == '\\') {
+				p++;
+				if (!skipEscape())
+					return false;
+			} else if (c >= 0x80) {
+				if (!skipUtf8())
+					return false;
+			} else
+				p++;
+		}
+
+		if (!refill())
+			return false;
+	}
+}
+
+// backslash already consumed
+bool JsonScanner::skipEscape()
+{
+	int c = peek();
+	if (c < 0)
+		return false;
+	p++;
+
+	switch (c) {
+	case '"': case '\\': case '/':
+	case 'b': case 'f': case 'n': case 'r': case 't':
+		return true;
+	case 'u':
+		for (int i = 0; i < 4; i++) {
+			if (!isxdigit(peek()))
+				return false;
+			p++;
+		}
+		return true;
+	default:
+		return false;
+	}
+}
+
+// One multi-byte UTF-8 sequence: no overlong forms, surrogates, or
+// code points past U+10FFFF
+bool JsonScanner::skipUtf8()
+{
+	int c = peek();
+	int lo = 0x80, hi = 0xBF;
+	int n;
+
+	if (c >= 0xC2 && c <= 0xDF)
+		n = 1;
+	else if (c >= 0xE0 && c <= 0xEF) {
+		n = 2;
+		if (c == 0xE0)
+			lo = 0xA0;
+		else if (c == 0xED)
+			hi = 0x9F;
+	} else if (c >= 0xF0 && c <= 0xF4) {
+		n = 3;
+		if (c == 0xF0)
+			lo = 0x90;
+		else if (c == 0xF4)
+			hi = 0x8F;
+	} else
+		return false;
+	p++;
+
+	for (int i = 0; i < n; i++) {
+		c = peek();
+		if (c < lo || c > hi)
+			return false;
+		p++;
+		lo = 0x80;
+		hi = 0xBF;
+	}
+
+	return true;
+}
+
+bool JsonScanner::skipWord(const char *word)
+{
+	for (; *word; word++) {
+		if (peek() != *word)
+			return false;
+		p++;
+	}
+	return true;
+}
+
+void JsonScanner::skipDigits()
+{
+	while (isdigit(peek()))
+		p++;
+}
+
+// true, false, null or a number, by the JSON grammar
+bool JsonScanner::skipScalar()
+{
+	int c = peek();
+	switch (c) {
+	case 't':
+		return skipWord("true");
+	case 'f':
+		return skipWord("false");
+	case 'n':
+		return skipWord("null");
+	case '-':
+		p++;
+		c = peek();
+		break;
+	}
+
+	if (!isdigit(c))
+		return false;
+	p++;
+	if (c != '0')
+		skipDigits();
+	else if (isdigit(peek()))
+		return false;		// no leading zeros
+
+	if (peek() == '.') {
+		p++;
+		if (!isdigit(peek()))
+			return false;
+		skipDigits();
+	}
+
+	c = peek();
+	if (c == 'e' || c == 'E') {
+		p++;
+		c = peek();
+		if (c == '+' || c == '-')
+			p++;
+		if (!isdigit(peek()))
+			return false;
+		skipDigits();
+	}
+
+	return true;
+}
+
+// positioned at '{' or '['
+bool JsonScanner::enter()
+{
+	if (open.size() == MAX_JSON_DEPTH)
+		return false;
+
+	open.push_back(*p == '{' ? '}' : ']');
+	p++;
+	return true;
+}
+
+// Check members and elements until open is back down to level
+// containers.  inside: just past an opening bracket; otherwise just
+// past a value (or at a closing bracket).
+bool JsonScanner::skipNested(size_t level, bool inside)
+{
+	while (open.size() > level) {
+		int c = skipWs();
+		if (inside) {
+			inside = false;
+			if (c == open.back()) {
+				p++;
+				open.pop_back();
+				continue;
+			}
+		} else {
+			if (c != ',') {
+				if (c != open.back())
+					return false;
+				p++;
+				open.pop_back();
+				continue;
+			}
+			p++;
+			c = skipWs();
+		}
+
+		// a member or element
+		if (open.back() == '}') {
+			if (c != '"')
+				return false;
+			p++;
+			if (!skipString() || skipWs() != ':')
+				return false;
+			p++;
+			c = skipWs();
+		}
+
+		if (c == '{' || c == '[') {
+			if (!enter())
+				return false;
+			inside = true;
+		} else if (c == '"') {
+			p++;
+			if (!skipString())
+				return false;
+		} else if (!skipScalar()) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool JsonScanner::skipValue()
+{
+	int c = skipWs();
+	if (c == '"') {
+		p++;
+		return skipString();
+	}
+	if (c != '{' && c != '[')
+		return skipScalar();
+
+	size_t level = open.size();
+	return enter() && skipNested(level, true);
+}
+
+// Once the path is resolved: close every open container, then allow
+// only trailing whitespace
+bool JsonScanner::finishInput()
+{
+	if (earlyStop)
+		return true;
+
+	return skipNested(0, false) && skipWs() < 0;
+}
+
+// positioned at opening quote
+bool JsonScanner::readKey(string& key)
+{
+	bool escaped = false;
+
+	key.clear();
+	p++;
+
+	while (1) {
+		int c = peek();
+		if (c < 0)
+			return false;
+		p++;
+
+		if (c == '"')
+			break;
+		if (c < 0x20)
+			return false;
+		if (c == '\\') {
+			escaped = true;
+			key.push_back(c);
+			c = peek();
+			if (c < 0)
+				return false;
+			p++;
+		}
+		key.push_back(c);
+	}
+
+	if (!is_valid_utf8(key.data(), key.size()))
+		return false;
+
+	// rare: let the JSON parser decode escapes exactly as it would
+	// for a full-document read
+	if (escaped) {
+		UniValue tmp;
+		if (!tmp.read("\"" + key + "\"") || !tmp.isStr())
+			return false;
+		key = tmp.getValStr();
+	}
+
+	return true;
+}
+
+bool JsonScanner::captureValue(string& out)
+{
+	out.clear();
+	skipWs();
+
+	capture = &out;
+	capStart = p;
+	bool rc = skipValue();
+	if (rc)
+		out.append(capStart, p - capStart);
+	capture = nullptr;
+
+	return rc;
+}
+
+// positioned just past '{'.  On hit, positioned at the member's value.
+bool JsonScanner::findMember(const string& key, bool& hit)
+{
+	hit = false;
+
+	int c = skipWs();
+	if (c == '}')
+		return true;
+
+	while (1) {
+		if (c != '"' || !readKey(keyBuf))
+			return false;
+		if (skipWs() != ':')
+			return false;
+		p++;
+
+		// first match wins, as with UniValue::operator[]
+		if (keyBuf == key) {
+			hit = true;
+			return true;
+		}
+
+		if (!skipValue())
+			return false;
+
+		c = skipWs();
+		if (c == '}')
+			return true;
+		if (c != ',')
+			return false;
+		p++;
+		c = skipWs();
+	}
+}
+
+// positioned just past '['.  On hit, positioned at the element;
+// otherwise at the ']', with count set to the number of elements.
+bool JsonScanner::findElement(unsigned long index, bool& hit,
+			      unsigned long& count)
+{
+	hit = false;
+	count = 0;
+
+	int c = skipWs();
+	if (c == ']')
+		return true;
+
+	for (unsigned long i = 0; ; i++) {
+		if (i == index) {
+			hit = true;
+			return true;
+		}
+
+		if (!skipValue())
+			return false;
+
+		c = skipWs();
+		if (c == ']') {
+			count = i + 1;
+			return true;
+		}
+		if (c != ',')
+			return false;
+		p++;
+	}
+}
+
+// Walk path from the current position.  On a match, found is set and
+// the scanner is positioned at the value; otherwise it is just past a
+// value or at a closing bracket, ready for finishInput().
+bool JsonScanner::seekPath(const JsonPath& path, bool& found)
+{
+	found = false;
+
+	for (size_t i = 0; i < path.size(); i++) {
+		const jpathSeg& seg = path[i];
+		bool hit = false;
+		unsigned long count;
+
+		int c = skipWs();
+		if (c == '[' && !seg.isIndex) {
+			// an array addressed by key: no match
+			return earlyStop || skipValue();
+		} else if (c == '{') {
+			if (!enter() || !findMember(*seg.key, hit))
+				return false;
+		} else if (c == '[') {
+			if (!enter() || !findElement(seg.index, hit, count))
+				return false;
+		} else if (i == 0) {
+			// the whole document is a scalar: cheap to check
+			// fully, trailing input included
+			string raw;
+			UniValue val;
+			return captureValue(raw) && skipWs() < 0 &&
+			       val.read(raw);
+		} else {
+			// path continues through a scalar: no match.
+			// premature end of input is an error.
+			return c >= 0 && skipValue();
+		}
+
+		if (!hit)
+			return true;
+	}
+
+	found = true;
+	return true;
+}
+
+// positioned at '['.  Collects the elements selected by a forward
+// slice as the JSON text of an array; the rest of the input is then
+// checked, unless stopping early.
+bool JsonScanner::captureSlice(const jpathSlice& slice, string& out)
+{
+	unsigned long first = slice.hasStart ? slice.start : 0;
+	string elem;
+
+	out = "[";
+	if (slice.hasEnd && slice.end == 0) {
+		out += ']';
+		return earlyStop || (skipValue() && finishInput());
+	}
+
+	if (!enter())
+		return false;
+
+	int c = skipWs();
+	for (unsigned long i = 0; c != ']'; i++) {
+		if (i >= first && (i - first) % slice.step == 0) {
+			if (!captureValue(elem))
+				return false;
+			if (out.size() > 1)
+				out += ',';
+			out += elem;
+		} else if (!skipValue()) {
+			return false;
+		}
+
+		// no need to look past the last element selected
+		if (slice.hasEnd && i + 1 >= (unsigned long) slice.end)
+			break;
+
+		c = skipWs();
+		if (c == ',') {
+			p++;
+			if ((c = skipWs()) == ']')
+				return false;
+		} else if (c != ']') {
+			return false;
+		}
+	}
+
+	out += ']';
+	return finishInput();
+}
+
+bool JsonScanner::findPath(const JsonPath& path, bool& found,
+			   string& rawValue)
+{
+	open.clear();
+
+	if (!path.sliced()) {
+		if (!seekPath(path, found))
+			return false;
+	} else {
+		// a slice applies to an array; on an object, it is a key
+		JsonPath parent(path), key;
+		parent.segs.pop_back();
+		key.segs.push_back(path.segs.back());
+
+		if (!seekPath(parent, found))
+			return false;
+
+		int c = skipWs();
+		if (found && c == '[')
+			return captureSlice(path.segs.back().slice, rawValue);
+
+		if (found && c != '{' && !parent.empty()) {
+			found = false;
+			if (c < 0 || !skipValue())
+				return false;
+		} else if (found && !seekPath(key, found)) {
+			return false;
+		}
+	}
+
+	if (found) {
+		found = false;
+		if (!captureValue(rawValue))
+			return false;
+		found = true;
+	}
+
+	return finishInput();
+}
+
+// State of one findPaths() scan
+class trieScan {
+public:
+	const PathTrie&	trie;
+	vector<string>&	raw;
+	vector<bool>&	found;
+	vector<size_t>	pending;	// terminals reached via node
+	vector<bool>	seen;
+	size_t		left;		// terminals not yet reached
+
+	trieScan(const PathTrie& trie_, vector<string>& raw_,
+		 vector<bool>& found_)
+		: trie(trie_), raw(raw_), found(found_),
+		  pending(trie_.nodes.size()), seen(trie_.nodes.size()),
+		  left(0) {}
+};
+
+// Capture the value at the current position for node n, and for the
+// nodes in also, which name the same value
+bool JsonScanner::captureNodes(trieScan& ts, size_t n,
+			       const vector<size_t>& also)
+{
+	if (!captureValue(ts.raw[n]))
+		return false;
+	ts.found[n] = true;
+	ts.left -= ts.pending[n];
+
+	for (size_t m : also) {
+		ts.raw[m] = ts.raw[n];
+		ts.found[m] = true;
+		ts.left -= ts.pending[m];
+	}
+
+	return true;
+}
+
+// Positioned at the value reached by trie node n
+bool JsonScanner::scanTrie(trieScan& ts, size_t n)
+{
+	const PathTrie::node& nd = ts.trie.nodes[n];
+	static const vector<size_t> none;
+
+	if (nd.terminal)
+		return captureNodes(ts, n, none);
+
+	int c = skipWs();
+	if (c == '{') {
+		if (!enter())
+			return false;
+		c = skipWs();
+		while (c != '}') {
+			if (c != '"' || !readKey(keyBuf))
+				return false;
+			if (skipWs() != ':')
+				return false;
+			p++;
+
+			// first match wins, as with UniValue::operator[]
+			auto it = nd.byKey.find(keyBuf);
+			if (it != nd.byKey.end() && !ts.seen[it->second]) {
+				ts.seen[it->second] = true;
+				if (!scanTrie(ts, it->second))
+					return false;
+				if (ts.left == 0)
+					return true;
+			} else if (!skipValue()) {
+				return false;
+			}
+
+			c = skipWs();
+			if (c == '}')
+				break;
+			if (c != ',')
+				return false;
+			p++;
+			c = skipWs();
+		}
+		p++;
+		open.pop_back();
+		return true;
+	}
+
+	if (c == '[') {
+		if (!enter())
+			return false;
+		c = skipWs();
+		for (unsigned long i = 0; c != ']'; i++) {
+			auto range = nd.byIndex.equal_range(i);
+			if (range.first == range.second) {
+				if (!skipValue())
+					return false;
+			} else {
+				// "3" and "03" both name element 3.  More
+				// than one node here: capture the element
+				// whole for all of them.
+				auto next = range.first;
+				if (++next == range.second) {
+					if (!scanTrie(ts, range.first->second))
+						return false;
+				} else {
+					vector<size_t> also;
+					for (auto it = next; it != range.second;
+					     ++it)
+						also.push_back(it->second);
+					if (!captureNodes(ts,
+							  range.first->second,
+							  also))
+						return false;
+				}
+				if (ts.left == 0)
+					return true;
+			}
+
+			c = skipWs();
+			if (c == ']')
+				break;
+			if (c != ',')
+				return false;
+			p++;
+			c = skipWs();
+		}
+		p++;
+		open.pop_back();
+		return true;
+	}
+
+	// paths continue through a scalar: no match
+	return c >= 0 && skipValue();
+}
+
+bool JsonScanner::findPaths(const JsonPath& prefix, const PathTrie& trie,
+			    vector<string>& raw, vector<bool>& found)
+{
+	raw.assign(trie.nodes.size(), string());
+	found.assign(trie.nodes.size(), false);
+	open.clear();
+
+	bool hit;
+	if (!seekPath(prefix, hit))
+		return false;
+	if (!hit)
+		return finishInput();
+
+	int c = skipWs();
+	if (prefix.empty() && c != '{' && c != '[') {
+		string rawDoc;
+		UniValue val;
+		return captureValue(rawDoc) && skipWs() < 0 &&
+		       val.read(rawDoc);
+	}
+
+	// children always follow their parent in the node list
+	trieScan ts(trie, raw, found);
+	for (size_t n = trie.nodes.size() - 1; n > 0; n--) {
+		const PathTrie::node& nd = trie.nodes[n];
+		if (nd.terminal)
+			ts.pending[n] = 1;
+		ts.pending[nd.parent] += ts.pending[n];
+	}
+	ts.left = ts.pending[0];
+	if (ts.left == 0)
+		return earlyStop || (skipValue() && finishInput());
+
+	return scanTrie(ts, 0) && finishInput();
+}
+
+bool JsonScanner::findSpot(const JsonPath& path, JsonSpot& spot)
+{
+	const char *base = map.data();
+	if (!eof || !base)
+		return false;
+
+	p = base;
+	open.clear();
+	spot.depth = 0;
+	spot.matched = false;
+
+	for (size_t i = 0; i <= path.size(); i++) {
+		int c = skipWs();
+		if (c < 0)
+			return false;
+
+		spot.depth = i;
+		spot.type = c;
+		spot.start = p - base;
+
+		if (i == path.size()) {
+			spot.matched = true;
+			return true;
+		}
+
+		const jpathSeg& seg = path[i];
+		bool hit = false;
+
+		// a scalar, or an array addressed by key: nothing below
+		if ((c != '{' && c != '[') || (c == '[' && !seg.isIndex))
+			return true;
+
+		p++;
+		const char *leadStart = p;
+		skipWs();
+		spot.lead.assign(leadStart, p - leadStart);
+		spot.count = 0;
+
+		if (c == '{') {
+			if (!findMember(*seg.key, hit))
+				return false;
+		} else if (!findElement(seg.index, hit, spot.count)) {
+			return false;
+		}
+
+		if (!hit) {
+			// positioned at the closing bracket
+			const char *q = p;
+			while (q[-1] == ' ' || q[-1] == '\t' ||
+			       q[-1] == '\n' || q[-1] == '\r')
+				q--;
+			spot.insertAt = q - base;
+			spot.empty = (spot.insertAt == spot.start + 1);
+			return true;
+		}
+	}
+
+	return true;
+}
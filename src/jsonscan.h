@@ -0,0 +1,120 @@
+#ifndef __JSONSCAN_H__
+#define __JSONSCAN_H__
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "fileutil.h"
+#include "jpath.h"
+
+// Where a path ends in a file, for in-place editing.  Offsets are
+// from the start of the input.
+class JsonSpot {
+public:
+	size_t		depth;		// path segments resolved
+	bool		matched;	// all of them: the value exists
+	char		type;		// first byte of the value reached
+	size_t		start;		// offset of that value
+
+	// containers only, when the path is not matched
+	size_t		insertAt;	// just past the last member
+	bool		empty;		// no members
+	unsigned long	count;		// array elements
+	std::string	lead;		// whitespace before first member
+};
+
+class trieScan;
+
+// Event-driven JSON path evaluator.  Walks raw input without building a
+// document tree: non-matching subtrees are skipped at scan speed and
+// only the selected value is copied out.  Skipped input is checked as
+// the JSON parser would check it, without building values, so
+// malformed input fails as it would for a full parse.  With early
+// stop set, reading ends as soon as the path is resolved, and the rest
+// of the input is not checked.
+class JsonScanner {
+private:
+	MappedInput	map;
+	int		fd;
+	std::string	buf;
+	const char	*base;		// start of input window
+	const char	*p;		// next unread byte
+	const char	*e;		// end of valid input window
+	bool		eof;
+	uint64_t	passed;		// bytes in earlier windows
+
+	std::string	*capture;	// raw bytes being collected, if any
+	const char	*capStart;
+	std::vector<char> open;		// closers of containers entered
+	std::string	keyBuf;
+	bool		earlyStop;
+
+	bool refill();
+
+	int peek() {
+		if (p == e && !refill())
+			return -1;
+		return (unsigned char) *p;
+	}
+
+	int skipWs();
+	bool skipString();
+	bool skipEscape();
+	bool skipUtf8();
+	bool skipWord(const char *word);
+	void skipDigits();
+	bool skipScalar();
+	bool enter();
+	bool skipNested(size_t level, bool inside);
+	bool skipValue();
+	bool finishInput();
+	bool readKey(std::string& key);
+	bool captureValue(std::string& out);
+	bool findMember(const std::string& key, bool& hit);
+	bool findElement(unsigned long index, bool& hit,
+			 unsigned long& count);
+	bool seekPath(const JsonPath& path, bool& found);
+	bool captureSlice(const jpathSlice& slice, std::string& out);
+	bool captureNodes(trieScan& ts, size_t n,
+			  const std::vector<size_t>& also);
+	bool scanTrie(trieScan& ts, size_t n);
+
+public:
+	JsonScanner() : fd(-1), base(nullptr), p(nullptr), e(nullptr),
+		eof(false), passed(0), capture(nullptr), capStart(nullptr),
+		earlyStop(false) {}
+
+	bool openFd(int fd_, const std::string& name);
+
+	// Stop reading once findPath() or findPaths() has its values
+	void stopEarly(bool stop) { earlyStop = stop; }
+
+	// bytes of input scanned so far
+	uint64_t consumed() const { return passed + (p - base); }
+
+	// Locate the value at a compiled JSON path, using the same
+	// matching rules as a full-document lookup.  On a match, found is
+	// set and the value's raw JSON text is stored in rawValue.  A
+	// final forward slice on an array yields an array of the selected
+	// elements.  Returns false if the input is malformed.
+	bool findPath(const JsonPath& path, bool& found,
+		      std::string& rawValue);
+
+	// Resolve every path of trie below the value at prefix, in one
+	// pass.  For each node n whose value was captured, found[n] is
+	// set and raw[n] holds its JSON text; the scan captures each
+	// path's end node, or an ancestor of it, and does not descend
+	// into captured values.  With early stop, reading ends once
+	// every path is resolved.  Returns false if the input is
+	// malformed.
+	bool findPaths(const JsonPath& prefix, const PathTrie& trie,
+		       std::vector<std::string>& raw,
+		       std::vector<bool>& found);
+
+	// Regular files only: walk path from the top of the input, as
+	// findPath() does, describing the deepest value reached.  May be
+	// called repeatedly.  Returns false if the input is malformed.
+	bool findSpot(const JsonPath& path, JsonSpot& spot);
+};
+
+#endif // __JSONSCAN_H__
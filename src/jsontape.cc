@@ -0,0 +1,573 @@
+
+#include "jup-config.h"
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <algorithm>
+#include "jsontape.h"
+
+#if defined(__x86_64__) || defined(__SSE2__)
+#include <emmintrin.h>
+#define TAPE_SSE2 1
+#endif
+
+using namespace std;
+
+// nesting limit of UniValue::read()
+static const size_t MAX_JSON_DEPTH = 512;
+
+// Bitmasks of quotes, backslashes and structural characters in the
+// 64 bytes at p
+static inline void classify(const char *p, uint64_t& quote,
+			    uint64_t& backslash, uint64_t& structural)
+{
+	quote = backslash = structural = 0;
+
+#ifdef TAPE_SSE2
+	const __m128i vQuote = _mm_set1_epi8('"');
+	const __m128i vBackslash = _mm_set1_epi8('\\');
+	const __m128i vCase = _mm_set1_epi8(0x20);
+	const __m128i vOpen = _mm_set1_epi8('{');
+	const __m128i vClose = _mm_set1_epi8('}');
+	const __m128i vColon = _mm_set1_epi8(':');
+	const __m128i vComma = _mm_set1_epi8(',');
+
+	for (int i = 0; i < 4; i++) {
+		__m128i v = _mm_loadu_si128((const __m128i *) (p + 16 * i));
+
+		// '[' and ']' differ from '{' and '}' only in bit 5
+		__m128i folded = _mm_or_si128(v, vCase);
+		__m128i s = _mm_or_si128(
+			_mm_or_si128(_mm_cmpeq_epi8(folded, vOpen),
+				     _mm_cmpeq_epi8(folded, vClose)),
+			_mm_or_si128(_mm_cmpeq_epi8(v, vColon),
+				     _mm_cmpeq_epi8(v, vComma)));
+
+		int shift = 16 * i;
+		quote |= (uint64_t) (uint16_t) _mm_movemask_epi8(
+				_mm_cmpeq_epi8(v, vQuote)) << shift;
+		backslash |= (uint64_t) (uint16_t) _mm_movemask_epi8(
+				_mm_cmpeq_epi8(v, vBackslash)) << shift;
+		structural |= (uint64_t) (uint16_t) _mm_movemask_epi8(s)
+				<< shift;
+	}
+#else
+	for (int i = 0; i < 64; i++) {
+		uint64_t bit = (uint64_t) 1 << i;
+		switch (p[i]) {
+		case '"':
+			quote |= bit;
+			break;
+		case '\\':
+			backslash |= bit;
+			break;
+		case '{': case '}': case '[': case ']': case ':': case ',':
+			structural |= bit;
+			break;
+		}
+	}
+#endif
+}
+
+// Characters escaped by a backslash: those after an odd-length run
+// of backslashes.  prevEscaped carries a run across blocks.
+static inline uint64_t findEscaped(uint64_t backslash, uint64_t& prevEscaped)
+{
+	const uint64_t evenBits = 0x5555555555555555ULL;
+
+	backslash &= ~prevEscaped;
+	uint64_t followsEscape = (backslash << 1) | prevEscaped;
+
+	// adding a run's start to the run carries out of its end; runs
+	// starting on even and odd bits are told apart by that carry
+	uint64_t oddStarts = backslash & ~evenBits & ~followsEscape;
+	uint64_t evenStartRuns = oddStarts + backslash;
+	prevEscaped = (evenStartRuns < oddStarts) ? 1 : 0;
+
+	return (evenBits ^ (evenStartRuns << 1)) & followsEscape;
+}
+
+// bit i set if an odd number of bits at or below i are set
+static inline uint64_t prefixXor(uint64_t x)
+{
+	x ^= x << 1;
+	x ^= x << 2;
+	x ^= x << 4;
+	x ^= x << 8;
+	x ^= x << 16;
+	x ^= x << 32;
+	return x;
+}
+
+bool JsonTape::build(const char *p, size_t n)
+{
+	base = p;
+	len = n;
+	tape.clear();
+	tape.reserve(n / 16);
+
+	vector<size_t> open;
+	uint64_t prevEscaped = 0, prevInString = 0;
+
+	for (size_t blk = 0; blk < n; blk += 64) {
+		uint64_t quote, backslash, structural;
+
+		if (n - blk >= 64) {
+			classify(p + blk, quote, backslash, structural);
+		} else {
+			char tail[64];
+			memset(tail, ' ', sizeof(tail));
+			memcpy(tail, p + blk, n - blk);
+			classify(tail, quote, backslash, structural);
+		}
+
+		quote &= ~findEscaped(backslash, prevEscaped);
+		uint64_t inString = prefixXor(quote) ^ prevInString;
+		prevInString = (uint64_t) ((int64_t) inString >> 63);
+		structural &= ~inString;
+
+		while (structural) {
+			size_t ofs = blk + __builtin_ctzll(structural);
+			structural &= structural - 1;
+
+			char c = p[ofs];
+			size_t idx = tape.size();
+			tape.push_back(tapeEntry{ofs, 0});
+
+			if (c == '{' || c == '[') {
+				if (open.size() == MAX_JSON_DEPTH)
+					return false;
+				open.push_back(idx);
+			} else if (c == '}' || c == ']') {
+				if (open.empty() ||
+				    (at(open.back()) == '{') != (c == '}'))
+					return false;
+				tape[open.back()].link = idx;
+				tape[idx].link = open.back();
+				open.pop_back();
+			}
+		}
+	}
+
+	if (prevInString || !open.empty() || tape.empty())
+		return false;
+
+	// one top-level container, with only whitespace around it
+	return (at(0) == '{' || at(0) == '[') &&
+	       skipWs(0) == tape[0].pos &&
+	       tape[0].link == tape.size() - 1 &&
+	       skipWs(tape.back().pos + 1) == len;
+}
+
+size_t JsonTape::skipWs(size_t ofs) const
+{
+	while (ofs < len && (base[ofs] == ' ' || base[ofs] == '\t' ||
+			     base[ofs] == '\n' || base[ofs] == '\r'))
+		ofs++;
+	return ofs;
+}
+
+// end of [from, to) without trailing whitespace
+size_t JsonTape::trimEnd(size_t from, size_t to) const
+{
+	while (to > from && (base[to - 1] == ' ' || base[to - 1] == '\t' ||
+			     base[to - 1] == '\n' || base[to - 1] == '\r'))
+		to--;
+	return to;
+}
+
+// index of the first entry at or after offset ofs
+size_t JsonTape::entryAt(size_t ofs) const
+{
+	return lower_bound(tape.begin(), tape.end(), ofs,
+			   [](const tapeEntry& ent, size_t o) {
+				return ent.pos < o;
+			   }) - tape.begin();
+}
+
+// Does the string token in [from, to) decode to key?
+bool JsonTape::matchKey(size_t from, size_t to, const string& key) const
+{
+	if (to - from < 2 || base[from] != '"' || base[to - 1] != '"')
+		return false;
+
+	const char *s = base + from + 1;
+	size_t n = to - from - 2;
+	if (!memchr(s, '\\', n))
+		return n == key.size() && !memcmp(s, key.data(), n);
+
+	// rare: decode escapes exactly as the JSON parser would
+	UniValue tmp;
+	return tmp.read(base + from, to - from) && tmp.isStr() &&
+	       tmp.getValStr() == key;
+}
+
+// Step over the value after entry e (an opening bracket, comma or
+// colon) of the container closed at entry close.  v is its offset and
+// vk its opening bracket's entry, or for a scalar the entry after it;
+// next is the comma or close that follows.  False if malformed.
+bool JsonTape::nextValue(size_t e, size_t close, size_t& v, size_t& vk,
+			 size_t& next) const
+{
+	v = skipWs(tape[e].pos + 1);
+	vk = e + 1;
+	if (vk > close)
+		return false;
+
+	if (base[v] == '{' || base[v] == '[') {
+		if (tape[vk].pos != v)
+			return false;
+		next = tape[vk].link + 1;
+	} else {
+		// a scalar must have some text before the next entry
+		if (v >= tape[vk].pos)
+			return false;
+		next = vk;
+	}
+
+	return next == close || (next < close && at(next) == ',');
+}
+
+// i: an object's opening brace.  First member named key, as
+// UniValue::operator[] would find it.
+bool JsonTape::findMember(size_t i, const string& key, size_t& v,
+			  size_t& vk, bool& hit) const
+{
+	size_t close = tape[i].link;
+	size_t e = i;
+
+	hit = false;
+	if (skipWs(tape[i].pos + 1) == tape[close].pos)
+		return true;
+
+	while (1) {
+		size_t colon = e + 1;
+		if (colon >= close || at(colon) != ':')
+			return false;
+
+		size_t next;
+		if (!nextValue(colon, close, v, vk, next))
+			return false;
+
+		size_t keyStart = skipWs(tape[e].pos + 1);
+		if (matchKey(keyStart, trimEnd(keyStart, tape[colon].pos),
+			     key)) {
+			hit = true;
+			return true;
+		}
+
+		if (next == close)
+			return true;
+		e = next;
+	}
+}
+
+// i: an array's opening bracket.  On a miss, count is its length.
+bool JsonTape::findElement(size_t i, unsigned long index, size_t& v,
+			   size_t& vk, bool& hit, unsigned long& count) const
+{
+	size_t close = tape[i].link;
+	size_t e = i;
+
+	hit = false;
+	count = 0;
+	if (skipWs(tape[i].pos + 1) == tape[close].pos)
+		return true;
+
+	for (unsigned long n = 0; ; n++) {
+		size_t next;
+		if (!nextValue(e, close, v, vk, next))
+			return false;
+
+		if (n == index) {
+			hit = true;
+			return true;
+		}
+
+		if (next == close) {
+			count = n + 1;
+			return true;
+		}
+		e = next;
+	}
+}
+
+bool JsonTape::findSpot(size_t from, const JsonPath& path,
+			JsonSpot& spot) const
+{
+	size_t v = from;
+	size_t vk = entryAt(from);
+
+	spot.depth = 0;
+	spot.matched = false;
+
+	for (size_t i = 0; i <= path.size(); i++) {
+		char c = base[v];
+
+		spot.depth = i;
+		spot.type = c;
+		spot.start = v;
+
+		if (i == path.size()) {
+			spot.matched = true;
+			return true;
+		}
+
+		const jpathSeg& seg = path[i];
+		bool hit;
+
+		// a scalar, or an array addressed by key: nothing below
+		if ((c != '{' && c != '[') || (c == '[' && !seg.isIndex))
+			return true;
+
+		size_t open = tape[vk].pos;
+		size_t close = tape[tape[vk].link].pos;
+		size_t first = skipWs(open + 1);
+		spot.lead.assign(base + open + 1, first - open - 1);
+		spot.insertAt = trimEnd(open + 1, close);
+		spot.empty = (first == close);
+		spot.count = 0;
+
+		size_t k = vk;
+		if (c == '{') {
+			if (!findMember(k, *seg.key, v, vk, hit))
+				return false;
+		} else if (!findElement(k, seg.index, v, vk, hit,
+					spot.count)) {
+			return false;
+		}
+
+		if (!hit)
+			return true;
+	}
+
+	return true;
+}
+
+// The scalar token [p, p + n) is one UniValue::read() would accept
+static bool checkScalar(const char *p, size_t n)
+{
+	if (n == 0)
+		return false;
+
+	if (*p == '"') {
+		if (n < 2 || p[n - 1] != '"')
+			return false;
+
+		bool escaped = false;
+		for (size_t i = 1; i < n - 1; i++) {
+			unsigned char ch = p[i];
+			if (ch < 0x20 || ch == '"')
+				return false;
+			if (ch == '\\') {
+				escaped = true;
+				i++;	// the escaped character
+			}
+		}
+
+		// escapes and surrogate pairs: ask the parser
+		UniValue tmp;
+		return !escaped || (tmp.read(p, n) && tmp.isStr());
+	}
+
+	if (*p == 't')
+		return n == 4 && !memcmp(p, "true", 4);
+	if (*p == 'f')
+		return n == 5 && !memcmp(p, "false", 5);
+	if (*p == 'n')
+		return n == 4 && !memcmp(p, "null", 4);
+
+	// -?(0|[1-9][0-9]*)(\.[0-9]+)?([eE][+-]?[0-9]+)?
+	const char *end = p + n;
+	if (*p == '-')
+		p++;
+	if (p == end || !isdigit((unsigned char) *p))
+		return false;
+	if (*p++ == '0' && p < end && isdigit((unsigned char) *p))
+		return false;
+	while (p < end && isdigit((unsigned char) *p))
+		p++;
+
+	if (p < end && *p == '.') {
+		p++;
+		if (p == end || !isdigit((unsigned char) *p))
+			return false;
+		while (p < end && isdigit((unsigned char) *p))
+			p++;
+	}
+
+	if (p < end && (*p == 'e' || *p == 'E')) {
+		p++;
+		if (p < end && (*p == '+' || *p == '-'))
+			p++;
+		if (p == end || !isdigit((unsigned char) *p))
+			return false;
+		while (p < end && isdigit((unsigned char) *p))
+			p++;
+	}
+
+	return p == end;
+}
+
+// A checked scalar token, as writeJson() writes its parsed value
+static void writeScalar(FdWriter& out, const char *p, size_t n)
+{
+	if (*p != '"') {
+		out.append(p, n);
+		return;
+	}
+
+	// strings are copied through unless the writer would spell
+	// them differently
+	for (size_t i = 1; i < n - 1; i++) {
+		if (p[i] == '\\' || p[i] == 0x7f) {
+			UniValue tmp;
+			tmp.read(p, n);
+			writeJson(out, tmp, 0);
+			return;
+		}
+	}
+
+	out.append(p, n);
+}
+
+// The value at offset v, with vk as nextValue() describes it.  With
+// out null, validate it; otherwise write it.
+bool JsonTape::walk(size_t v, size_t vk, FdWriter *out,
+		    unsigned int prettyIndent, unsigned int indentLevel,
+		    const tapeAdditions& added) const
+{
+	if (indentLevel == 0)
+		indentLevel = 1;
+
+	char c = base[v];
+	if (c != '{' && c != '[') {
+		size_t end = trimEnd(v, vk < tape.size() ? tape[vk].pos : len);
+		if (!out)
+			return checkScalar(base + v, end - v);
+
+		writeScalar(*out, base + v, end - v);
+		return true;
+	}
+
+	bool isObject = (c == '{');
+	size_t close = tape[vk].link;
+	size_t nMembers = 0;
+
+	if (out) {
+		out->push(c);
+		if (prettyIndent)
+			out->push('\n');
+	}
+
+	auto memberStart = [&]() {
+		if (nMembers++ > 0) {
+			out->push(',');
+			if (prettyIndent)
+				out->push('\n');
+		}
+		if (prettyIndent)
+			writeJsonIndent(*out, prettyIndent * indentLevel);
+	};
+
+	if (skipWs(tape[vk].pos + 1) != tape[close].pos) {
+		size_t e = vk;
+
+		while (1) {
+			size_t colon = e;
+			if (isObject) {
+				colon = e + 1;
+				if (colon >= close || at(colon) != ':')
+					return false;
+			}
+
+			size_t mv, mvk, next;
+			if (!nextValue(colon, close, mv, mvk, next))
+				return false;
+
+			if (isObject) {
+				size_t keyStart = skipWs(tape[e].pos + 1);
+				size_t keyEnd = trimEnd(keyStart,
+							tape[colon].pos);
+				if (!out) {
+					if (base[keyStart] != '"' ||
+					    !checkScalar(base + keyStart,
+							 keyEnd - keyStart))
+						return false;
+				} else {
+					memberStart();
+					writeScalar(*out, base + keyStart,
+						    keyEnd - keyStart);
+					out->push(':');
+					if (prettyIndent)
+						out->push(' ');
+				}
+			} else if (out) {
+				memberStart();
+			}
+
+			if (!walk(mv, mvk, out, prettyIndent, indentLevel + 1,
+				  added))
+				return false;
+
+			if (next == close)
+				break;
+			e = next;
+		}
+	}
+
+	if (!out)
+		return true;
+
+	// members added by the program follow the original ones
+	tapeAdditions::const_iterator it = added.find(v);
+	if (it != added.end()) {
+		const UniValue& extra = it->second;
+		const vector<UniValue>& values = extra.getValues();
+
+		for (size_t i = 0; i < values.size(); i++) {
+			memberStart();
+			if (isObject) {
+				writeJson(*out, UniValue(extra.getKeys()[i]), 0);
+				out->push(':');
+				if (prettyIndent)
+					out->push(' ');
+			}
+			writeJson(*out, values[i], prettyIndent,
+				  indentLevel + 1);
+		}
+	}
+
+	if (prettyIndent) {
+		if (nMembers > 0)
+			out->push('\n');
+		writeJsonIndent(*out, prettyIndent * (indentLevel - 1));
+	}
+	out->push(isObject ? '}' : ']');
+	return true;
+}
+
+bool JsonTape::materialize(size_t ofs, UniValue& val) const
+{
+	size_t k = entryAt(ofs);
+	size_t end;
+
+	if (base[ofs] == '{' || base[ofs] == '[')
+		end = tape[tape[k].link].pos + 1;
+	else
+		end = trimEnd(ofs, k < tape.size() ? tape[k].pos : len);
+
+	return val.read(base + ofs, end - ofs);
+}
+
+bool JsonTape::check(size_t ofs) const
+{
+	static const tapeAdditions none;
+	return walk(ofs, entryAt(ofs), nullptr, 0, 0, none);
+}
+
+void JsonTape::write(FdWriter& out, size_t ofs, unsigned int prettyIndent,
+		     const tapeAdditions& added) const
+{
+	walk(ofs, entryAt(ofs), &out, prettyIndent, 0, added);
+}
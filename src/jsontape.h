@@ -0,0 +1,78 @@
+#ifndef __JSONTAPE_H__
+#define __JSONTAPE_H__
+
+#include <string>
+#include <vector>
+#include <map>
+#include "univalue/include/univalue.h"
+#include "jpath.h"
+#include "jsonscan.h"
+#include "jsonwriter.h"
+
+// Members added to raw containers, keyed by the container's offset.
+// Each holds an object or array of the new members only.
+typedef std::map<size_t, UniValue> tapeAdditions;
+
+// Structural index of a JSON text: the offset of every brace,
+// bracket, colon and comma outside strings, with each opening bracket
+// linked to its match.  Built a vector at a time without decoding any
+// values; paths are then resolved by hopping over whole containers,
+// and only the values actually needed are parsed or checked.
+class JsonTape {
+private:
+	class tapeEntry {
+	public:
+		size_t	pos;
+		size_t	link;		// brackets: index of the match
+	};
+
+	const char		*base;
+	size_t			len;
+	std::vector<tapeEntry>	tape;
+
+	char at(size_t i) const { return base[tape[i].pos]; }
+	size_t skipWs(size_t ofs) const;
+	size_t trimEnd(size_t from, size_t to) const;
+	size_t entryAt(size_t ofs) const;
+	bool matchKey(size_t from, size_t to, const std::string& key) const;
+	bool nextValue(size_t e, size_t close, size_t& v, size_t& vk,
+		       size_t& next) const;
+	bool findMember(size_t i, const std::string& key, size_t& v,
+			size_t& vk, bool& hit) const;
+	bool findElement(size_t i, unsigned long index, size_t& v,
+			 size_t& vk, bool& hit, unsigned long& count) const;
+	bool walk(size_t v, size_t vk, FdWriter *out,
+		  unsigned int prettyIndent, unsigned int indentLevel,
+		  const tapeAdditions& added) const;
+
+public:
+	JsonTape() : base(nullptr), len(0) {}
+
+	// Index text.  Fails on unbalanced brackets, an unterminated
+	// string, nesting deeper than UniValue accepts, or anything but
+	// whitespace around a single top-level container.
+	bool build(const char *p, size_t n);
+
+	// offset of the top-level value
+	size_t root() const { return tape.empty() ? 0 : tape[0].pos; }
+
+	// JsonScanner::findSpot(), starting from the value at offset
+	// from rather than the top of the input
+	bool findSpot(size_t from, const JsonPath& path,
+		      JsonSpot& spot) const;
+
+	// Parse the value at offset ofs
+	bool materialize(size_t ofs, UniValue& val) const;
+
+	// Fully validate the value at offset ofs, which the build only
+	// checked structurally
+	bool check(size_t ofs) const;
+
+	// Write the (checked) value at offset ofs exactly as writeJson()
+	// would write its parsed form, with each container's additions
+	// after its own members
+	void write(FdWriter& out, size_t ofs, unsigned int prettyIndent,
+		   const tapeAdditions& added) const;
+};
+
+#endif // __JSONTAPE_H__
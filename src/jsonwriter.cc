@@ -0,0 +1,230 @@
+
+#include "jup-config.h"
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include "jsonwriter.h"
+
+using namespace std;
+
+bool FdWriter::writeFd(const char *p, size_t n)
+{
+	written += n;
+
+	if (sink) {
+		sink->append(p, n);
+		return true;
+	}
+
+	StatsClock t0;
+	if (ioTime)
+		t0 = StatsClock::now();
+
+	bool ok = true;
+	while (n > 0) {
+		ssize_t wrc = write(fd, p, n);
+		if (wrc < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("(stdout)");
+			ok = false;
+			break;
+		}
+		p += wrc;
+		n -= wrc;
+	}
+
+	if (ioTime)
+		ioTime->add(t0, StatsClock::now());
+	return ok;
+}
+
+void FdWriter::append(const char *p, size_t n)
+{
+	if (n > buf.size() - len) {
+		flush();
+
+		// large runs bypass the buffer
+		if (n >= buf.size()) {
+			if (!error && !writeFd(p, n))
+				error = true;
+			return;
+		}
+	}
+
+	memcpy(&buf[len], p, n);
+	len += n;
+}
+
+bool FdWriter::flush()
+{
+	if (len > 0 && !error && !writeFd(&buf[0], len))
+		error = true;
+
+	len = 0;
+	return !error;
+}
+
+// adapt std::string to the FdWriter interface
+class StringSink {
+public:
+	string& s;
+
+	explicit StringSink(string& s_) : s(s_) {}
+	void append(const char *p, size_t n) { s.append(p, n); }
+	void append(const string& str) { s.append(str); }
+	void push(char c) { s.push_back(c); }
+};
+
+template<typename Sink>
+static void writeEscaped(Sink& out, const string& str)
+{
+	const char *p = str.data();
+	const char *end = p + str.size();
+	const char *run = p;
+
+	out.push('"');
+
+	for (; p < end; p++) {
+		unsigned char ch = *p;
+		if (ch >= 0x20 && ch != '"' && ch != '\\' && ch != 0x7f)
+			continue;
+
+		// flush the run of bytes needing no escape
+		out.append(run, p - run);
+		run = p + 1;
+
+		switch (ch) {
+		case '"':	out.append("\\\"", 2); break;
+		case '\\':	out.append("\\\\", 2); break;
+		case '\b':	out.append("\\b", 2); break;
+		case '\f':	out.append("\\f", 2); break;
+		case '\n':	out.append("\\n", 2); break;
+		case '\r':	out.append("\\r", 2); break;
+		case '\t':	out.append("\\t", 2); break;
+		default: {
+			char tmp[8];
+			snprintf(tmp, sizeof(tmp), "\\u%04x", ch);
+			out.append(tmp, 6);
+			break;
+		}
+		}
+	}
+
+	out.append(run, p - run);
+	out.push('"');
+}
+
+template<typename Sink>
+static void writeIndent(Sink& out, unsigned int n)
+{
+	static const char spaces[] = "                                ";
+	const size_t chunk = sizeof(spaces) - 1;
+
+	while (n > 0) {
+		size_t c = (n < chunk) ? n : chunk;
+		out.append(spaces, c);
+		n -= c;
+	}
+}
+
+// mirrors UniValue::write()/writeArray()/writeObject() formatting
+template<typename Sink>
+static void writeValue(Sink& out, const UniValue& val,
+		       unsigned int prettyIndent, unsigned int indentLevel)
+{
+	if (indentLevel == 0)
+		indentLevel = 1;
+
+	switch (val.getType()) {
+	case UniValue::VNULL:
+		out.append("null", 4);
+		break;
+
+	case UniValue::VBOOL:
+		if (val.isTrue())
+			out.append("true", 4);
+		else
+			out.append("false", 5);
+		break;
+
+	case UniValue::VNUM:
+		out.append(val.getValStr());
+		break;
+
+	case UniValue::VSTR:
+		writeEscaped(out, val.getValStr());
+		break;
+
+	case UniValue::VARR: {
+		const vector<UniValue>& values = val.getValues();
+
+		out.push('[');
+		if (prettyIndent)
+			out.push('\n');
+
+		for (size_t i = 0; i < values.size(); i++) {
+			if (prettyIndent)
+				writeIndent(out, prettyIndent * indentLevel);
+			writeValue(out, values[i], prettyIndent,
+				   indentLevel + 1);
+			if (i != (values.size() - 1))
+				out.push(',');
+			if (prettyIndent)
+				out.push('\n');
+		}
+
+		if (prettyIndent)
+			writeIndent(out, prettyIndent * (indentLevel - 1));
+		out.push(']');
+		break;
+	}
+
+	case UniValue::VOBJ: {
+		const vector<string>& keys = val.getKeys();
+		const vector<UniValue>& values = val.getValues();
+
+		out.push('{');
+		if (prettyIndent)
+			out.push('\n');
+
+		for (size_t i = 0; i < keys.size(); i++) {
+			if (prettyIndent)
+				writeIndent(out, prettyIndent * indentLevel);
+			writeEscaped(out, keys[i]);
+			out.push(':');
+			if (prettyIndent)
+				out.push(' ');
+			writeValue(out, values[i], prettyIndent,
+				   indentLevel + 1);
+			if (i != (values.size() - 1))
+				out.push(',');
+			if (prettyIndent)
+				out.push('\n');
+		}
+
+		if (prettyIndent)
+			writeIndent(out, prettyIndent * (indentLevel - 1));
+		out.push('}');
+		break;
+	}
+	}
+}
+
+void writeJson(FdWriter& out, const UniValue& val, unsigned int prettyIndent,
+	       unsigned int indentLevel)
+{
+	writeValue(out, val, prettyIndent, indentLevel);
+}
+
+void writeJson(string& out, const UniValue& val, unsigned int prettyIndent)
+{
+	StringSink sink(out);
+	writeValue(sink, val, prettyIndent, 0);
+}
+
+void writeJsonIndent(FdWriter& out, unsigned int n)
+{
+	writeIndent(out, n);
+}
@@ -0,0 +1,73 @@
+#ifndef __JSONWRITER_H__
+#define __JSONWRITER_H__
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "univalue/include/univalue.h"
+#include "stats.h"
+
+// Fixed-size output buffer, flushed to a file descriptor as it fills
+// (or appended to a string, to collect output in memory).
+class FdWriter {
+private:
+	int			fd;
+	std::string		*sink;
+	std::vector<char>	buf;
+	size_t			len;
+	bool			error;
+	uint64_t		written;
+	StatsClock		*ioTime;	// if set, accumulates write time
+
+	bool writeFd(const char *p, size_t n);
+
+public:
+	explicit FdWriter(int fd_, size_t bufSize = 65536)
+		: fd(fd_), sink(nullptr), buf(bufSize), len(0), error(false),
+		  written(0), ioTime(nullptr) {}
+	explicit FdWriter(std::string& sink_, size_t bufSize = 65536)
+		: fd(-1), sink(&sink_), buf(bufSize), len(0), error(false),
+		  written(0), ioTime(nullptr) {}
+	~FdWriter() { flush(); }
+
+	FdWriter(const FdWriter&) = delete;
+	FdWriter& operator=(const FdWriter&) = delete;
+
+	void append(const char *p, size_t n);
+	void append(const std::string& s) { append(s.data(), s.size()); }
+	void push(char c) {
+		if (len == buf.size())
+			flush();
+		buf[len++] = c;
+	}
+
+	// Free space for the caller to fill in place, at least minLen
+	// bytes (flushing first if needed); finish with commit().
+	char *reserve(size_t minLen, size_t& avail) {
+		if (buf.size() - len < minLen)
+			flush();
+		avail = buf.size() - len;
+		return &buf[len];
+	}
+	void commit(size_t n) { len += n; }
+
+	bool flush();
+	bool ok() const { return !error; }
+
+	// bytes handed to the fd or sink so far
+	uint64_t bytesWritten() const { return written; }
+	void timeWrites(StatsClock *t) { ioTime = t; }
+};
+
+// Serialize val exactly as UniValue::write(prettyIndent) would, but
+// straight into the output buffer rather than one large string.
+// indentLevel is val's nesting depth within an enclosing document.
+extern void writeJson(FdWriter& out, const UniValue& val,
+		      unsigned int prettyIndent, unsigned int indentLevel = 0);
+extern void writeJson(std::string& out, const UniValue& val,
+		      unsigned int prettyIndent);
+
+// n spaces of indentation
+extern void writeJsonIndent(FdWriter& out, unsigned int n);
+
+#endif // __JSONWRITER_H__
@@ -2,8 +2,14 @@
 #include "jup-config.h"
 #include <vector>
 #include <deque>
+#include <map>
 #include <string>
-#include <regex>
+#include <algorithm>
+#include <unordered_set>
+#include <memory>
+#include <functional>
+#include <atomic>
+#include <new>
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -11,10 +17,24 @@
 #include <errno.h>
 #include <string.h>
 #include <ctype.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
 #include <argp.h>
 #include "univalue/include/univalue.h"
 #include "utilstrencodings.h"
+#include "arena.h"
+#include "csv.h"
 #include "fileutil.h"
+#include "jpath.h"
+#include "jsonscan.h"
+#include "jsontape.h"
+#include "jsonwriter.h"
+#include "keyindex.h"
+#include "memprofile.h"
+#include "server.h"
+#include "stats.h"
+#include "threadpool.h"
 #include "utf8.h"
 
 using namespace std;
@@ -35,59 +55,161 @@ static struct argp_option options[] = {
 	{"indent", 1003, "NUM", 0, "Set JSON output indent spacing (0=disable). Overrides JUP_INDENT env var."},
 	{"unhex", 1004, 0, 0, "If output is a simple string, perform hex-decode."},
 	{"un64", 1005, 0, 0, "If output is a simple string, perform base64-decode."},
+	{"lines", 1007, 0, 0, "Input is newline-delimited JSON (JSON Lines).  Apply edit commands to each record, writing one minimized output line per record."},
+	{"threads", 1008, "NUM", 0, "With --lines or --batch, process records or files on NUM worker threads (0=one per CPU).  Output order matches input order."},
+	{"csv-header", 1009, 0, 0, "file.csv: first record names the columns.  Store each row as an object keyed by column name."},
+	{"batch", 1011, "LIST", 0, "Apply edit commands to each JSON file named in LIST (one path per line, - for stdin) or found in directory LIST.  Uses --threads workers; reports each file on stderr."},
+	{"output-dir", 1012, "DIR", 0, "With --batch, write each result to DIR/<input file name> rather than to stdout."},
+	{"serve", 1013, "SOCKET", 0, "Run as a server on UNIX socket SOCKET, with --threads worker processes (default one per CPU).  jupc, run with JUP_SERVER=SOCKET in the environment, passes its invocation to the server, skipping jup's process startup."},
+	{"csv-types", 1010, 0, 0, "file.csv: store columns that hold only numbers, only booleans, or null as those JSON types rather than strings.  Detection follows the set command."},
+	{"arena", 1014, 0, 0, "Build the input document, and files read by file.json, in one bump-allocated arena that is released in a single step.  Faster on large documents; memory freed while parsing is not reused."},
+	{"no-free", 1015, 0, 0, "Exit without freeing the document."},
+	{"lazy", 1017, 0, 0, "Index the input document instead of parsing it.  Only values reached by edit commands are parsed; the rest is checked and written straight from the input.  Faster when commands touch a small part of a large document."},
+	{"in-place", 1016, "FILE", 0, "Apply edit commands to JSON FILE itself, rather than stdin to stdout.  Only the containers edited are rewritten; the rest of FILE is copied byte for byte."},
+	{"mem-profile", 1019, "N", OPTION_ARG_OPTIONAL, "Report memory use to stderr as one line of JSON: allocations and bytes for the whole run, peak heap and RSS, and the N (default 10) subtrees of the output document holding the most memory, by JSON path."},
+	{"stop-early", 1020, 0, 0, "When only get commands are given, stop reading input as soon as the value is found.  The rest of the input is not checked, so malformed input may go unreported."},
+	{"stats", 1018, "FILE", OPTION_ARG_OPTIONAL, "Write a one-line JSON timing report to FILE (default stderr): wall and CPU time, bytes in and out, and MB/s for the run, for each phase and each command, plus node counts of the output document.  Output is unchanged."},
 
 	{ }
 };
 
+enum cmdId {
+	CMD_GET,
+	CMD_NEW,
+	CMD_NEWARRAY,
+	CMD_SET,
+	CMD_STR,
+	CMD_INT,
+	CMD_NUM,
+	CMD_TRUE,
+	CMD_FALSE,
+	CMD_NULL,
+	CMD_ARRAY,
+	CMD_OBJECT,
+	CMD_FILE_TEXT,
+	CMD_FILE_JSON,
+	CMD_FILE_HEX,
+	CMD_FILE_BASE64,
+	CMD_FILE_CSV,
+	CMD_GET_ARRAY,
+	CMD_GET_OBJECT,
+};
+
 class commandInfo {
 public:
+	cmdId id;
 	unsigned int n_args;
-	string name;
-	string summary;
-	string description;
+	const char *name;
+	const char *summary;
+	const char *description;
 	bool ignoreStdin;
 };
 
-static commandInfo commandList[] = {
-	{ 1, "get", "get JSON-PATH",
+// indexed by cmdId
+static const commandInfo commandList[] = {
+	{ CMD_GET, 1, "get", "get JSON-PATH",
 	  "Replace document with subset of JSON input, starting at JSON-PATH" },
 
-	{ 0, "new", "new",
+	{ CMD_NEW, 0, "new", "new",
 	  "Create document with empty object.  stdin ignored.", true },
-	{ 0, "newarray", "newarray",
+	{ CMD_NEWARRAY, 0, "newarray", "newarray",
 	  "Create document with empty array.  stdin ignored.", true },
 
-	{ 2, "set", "set JSON-PATH VALUE",
+	{ CMD_SET, 2, "set", "set JSON-PATH VALUE",
 	  "Store VALUE at JSON-PATH.  Auto-detect value type." },
-	{ 2, "str", "str JSON-PATH VALUE",
+	{ CMD_STR, 2, "str", "str JSON-PATH VALUE",
 	  "Store VALUE at JSON-PATH" },
-	{ 2, "int", "int JSON-PATH VALUE",
+	{ CMD_INT, 2, "int", "int JSON-PATH VALUE",
 	  "Store integer VALUE at JSON-PATH" },
-	{ 2, "num", "num JSON-PATH VALUE",
+	{ CMD_NUM, 2, "num", "num JSON-PATH VALUE",
 	  "Store floating point VALUE at JSON-PATH" },
 
-	{ 1, "true", "true JSON-PATH",
+	{ CMD_TRUE, 1, "true", "true JSON-PATH",
 	  "Store boolean true at JSON-PATH" },
-	{ 1, "false", "false JSON-PATH",
+	{ CMD_FALSE, 1, "false", "false JSON-PATH",
 	  "Store boolean false at JSON-PATH" },
-	{ 1, "null", "null JSON-PATH",
+	{ CMD_NULL, 1, "null", "null JSON-PATH",
 	  "Store null at JSON-PATH" },
 
-	{ 1, "array", "array JSON-PATH",
+	{ CMD_ARRAY, 1, "array", "array JSON-PATH",
 	  "Store empty array at JSON-PATH" },
-	{ 1, "object", "object JSON-PATH",
+	{ CMD_OBJECT, 1, "object", "object JSON-PATH",
 	  "Store empty object at JSON-PATH" },
 
-	{ 2, "file.text", "file.text JSON-PATH FILE",
+	{ CMD_FILE_TEXT, 2, "file.text", "file.text JSON-PATH FILE",
 	  "Store content of FILE at JSON-PATH" },
-	{ 2, "file.json", "file.json JSON-PATH FILE",
+	{ CMD_FILE_JSON, 2, "file.json", "file.json JSON-PATH FILE",
 	  "Store content of JSON FILE at JSON-PATH" },
-	{ 2, "file.hex", "file.hex JSON-PATH FILE",
+	{ CMD_FILE_HEX, 2, "file.hex", "file.hex JSON-PATH FILE",
 	  "Store (binary?) hex-encoded content of FILE at JSON-PATH" },
-	{ 2, "file.base64", "file.base64 JSON-PATH FILE",
+	{ CMD_FILE_BASE64, 2, "file.base64", "file.base64 JSON-PATH FILE",
 	  "Store (binary?) base64-encoded content of FILE at JSON-PATH" },
-	{ 2, "file.csv", "file.csv JSON-PATH FILE",
+	{ CMD_FILE_CSV, 2, "file.csv", "file.csv JSON-PATH FILE",
 	  "Decode and store CSV-formatted content of FILE at JSON-PATH" },
+
+	{ CMD_GET_ARRAY, 1, "get.array", "get.array JSON-PATHS",
+	  "Replace document with array of values at comma-separated JSON-PATHS" },
+	{ CMD_GET_OBJECT, 1, "get.object", "get.object JSON-PATHS",
+	  "Replace document with object of values at comma-separated JSON-PATHS, keyed by path" },
+};
+
+// Perfect hash over command names:
+//	(len + 13*name[0] + 7*name[len-1]) & 31
+// is distinct for every command.  Adding a command requires choosing
+// new multipliers (or table size) that keep it collision-free.
+static const int CMD_HASH_SIZE = 32;
+
+static const signed char cmdHashTable[CMD_HASH_SIZE] = {
+	-1, CMD_ARRAY, -1, CMD_FILE_TEXT,		// 0-3
+	CMD_INT, CMD_FILE_BASE64, CMD_SET, -1,		// 4-7
+	-1, -1, CMD_GET, CMD_TRUE,			// 8-11
+	-1, CMD_NEWARRAY, CMD_NULL, -1,			// 12-15
+	CMD_FILE_CSV, CMD_GET_OBJECT, -1, CMD_GET_ARRAY,	// 16-19
+	CMD_NUM, CMD_OBJECT, CMD_FALSE, -1,		// 20-23
+	CMD_STR, CMD_FILE_JSON, CMD_NEW, -1,		// 24-27
+	-1, -1, CMD_FILE_HEX, -1,			// 28-31
+};
+
+static const commandInfo *lookupCommand(const string& name)
+{
+	size_t len = name.size();
+	if (len == 0)
+		return nullptr;
+
+	unsigned int h = (len + 13 * (unsigned char) name[0] +
+			  7 * (unsigned char) name[len - 1]) &
+			 (CMD_HASH_SIZE - 1);
+
+	int idx = cmdHashTable[h];
+	if (idx < 0 || name != commandList[idx].name)
+		return nullptr;
+
+	return &commandList[idx];
+}
+
+static bool isMultiGet(cmdId id)
+{
+	return id == CMD_GET_ARRAY || id == CMD_GET_OBJECT;
+}
+
+// One compiled edit command.  Arguments are validated, paths are
+// tokenized and literal values are built once, before any document is
+// read, so per-document execution does no parsing.
+class editOp {
+public:
+	const commandInfo *cmd;
+	vector<string> args;
+	JsonPath path;			// compiled args[0], if a JSON-PATH
+	UniValue value;			// pre-built value for store commands
+
+	// get.array, get.object: args[0] split on commas, merged into
+	// one trie.  pathNodes[i] is path i's trie node, or 0 if it
+	// can never match.
+	vector<string> pathNames;
+	vector<size_t> pathNodes;
+	PathTrie trie;
+
+	editOp() : cmd(nullptr) {}
 };
 
 static error_t parse_opt (int key, char *arg, struct argp_state *state);
@@ -99,27 +221,46 @@ static bool doListUsages = false;
 enum optDecodeType { DecNone, DecBase64, DecHex };
 static optDecodeType optDecodeMode = DecNone;
 static int defaultIndent = 2;
+static bool linesMode = false;
+static unsigned int nThreads = 1;
+static bool csvHeader = false;
+static bool csvTypes = false;
+static string batchList;
+static string outputDir;
+static bool threadsGiven = false;
+static string serveSocket;
+static bool useArena = false;
+static bool noFree = false;
+static string inPlaceFile;
+static bool lazyMode = false;
+static bool statsWanted = false;
+static string statsFile;
+static JupStats jupStats;
+static bool memProfile = false;
+static unsigned int memProfileTop = 10;
+static bool stopEarly = false;
 UniValue jdoc(UniValue::VNULL);
-map<string,commandInfo> cmdMap;
 deque<string> inputTokens;
-
-static void staticInit()
-{
-	for (unsigned int i = 0; i < ARRAYLEN(commandList); i++) {
-		cmdMap[commandList[i].name] = commandList[i];
-	}
-}
+static vector<editOp> program;
+static thread_local KeyIndexCache objIndex;	// per-thread document
 
 static void listCommands(bool longForm)
 {
 	UniValue l(UniValue::VARR);
 	UniValue shortl(UniValue::VARR);
 
-	for (map<string,commandInfo>::const_iterator it = cmdMap.begin();
-	     it != cmdMap.end(); it++) {
+	vector<const commandInfo *> sorted;
+	for (unsigned int i = 0; i < ARRAYLEN(commandList); i++)
+		sorted.push_back(&commandList[i]);
+	sort(sorted.begin(), sorted.end(),
+	     [](const commandInfo *a, const commandInfo *b) {
+		return strcmp(a->name, b->name) < 0;
+	});
+
+	for (const commandInfo *pci : sorted) {
 		UniValue obj(UniValue::VOBJ);
 
-		const commandInfo& ci = it->second;
+		const commandInfo& ci = *pci;
 
 		obj.pushKV("command", ci.name);
 		obj.pushKV("usage", ci.summary);
@@ -173,171 +314,172 @@ static error_t parse_opt (int key, char *arg, struct argp_state *state)
 		optDecodeMode = DecBase64;
 		break;
 
-	case ARGP_KEY_ARG:
-		inputTokens.push_back(arg);
+	case 1007:
+		linesMode = true;
 		break;
 
-	case ARGP_KEY_END:
+	case 1008: {
+		string threadsStr(arg);
+		if (!isDigitStr(threadsStr) || threadsStr.empty()) {
+			fprintf(stderr, "Invalid thread count %s\n", arg);
+			return EINVAL;
+		}
+		nThreads = atoi(arg);
+		if (nThreads == 0)
+			nThreads = defaultThreadCount();
+		threadsGiven = true;
 		break;
-
-	default:
-		return ARGP_ERR_UNKNOWN;
 	}
 
-	return 0;
-}
+	case 1009:
+		csvHeader = true;
+		break;
 
-static bool readJsonFile(const string& filename, UniValue& jbody)
-{
-	string body;
-	if (!readTextFile(filename, body))
-		return false;
+	case 1010:
+		csvTypes = true;
+		break;
 
-	if (!jbody.read(body)) {
-		fprintf(stderr, "%s: JSON data not valid\n",
-			filename.c_str());
-		return false;
-	}
+	case 1011:
+		batchList = arg;
+		break;
 
-	return true;
-}
+	case 1012:
+		outputDir = arg;
+		break;
 
-static vector<string> ParseLineDelim(const string& line, char delim = ',',
-				     bool parseQuotes = true)
-{
-	vector<string> data;
-	string cur;
-	size_t pos = 0;
-	bool quoting = false;
-	bool started = false;
-
-	while (pos < line.size()) {
-		char ch = line[pos++];
-
-		if (quoting) {
-			started = true;
-			if (ch == '"')
-				quoting = false;
-			else
-				cur.append(1, ch);
-		} else {
-			if ((ch == '"') && (parseQuotes)) {
-				quoting = true;
-				if (started)
-					cur.append(1, ch);
-
-			} else if (ch == delim) {
-				data.push_back(cur);
-				cur.clear();
-				started = false;
-			} else if (ch == '\r') {
-				// ignore
-			} else if (ch == '\n') {
-				break;
-			} else
-				cur.append(1, ch);
-		}
-	}
+	case 1013:
+		serveSocket = arg;
+		break;
 
-	data.push_back(cur);
+	case 1014:
+		useArena = true;
+		break;
 
-	return data;
-}
+	case 1015:
+		noFree = true;
+		break;
 
-static bool readDelimFile(const string& filename, UniValue& jbody)
-{
-	if (!jbody.isArray()) {
-		fprintf(stderr, "Input not an array\n");
-		return false;
-	}
+	case 1016:
+		inPlaceFile = arg;
+		break;
 
-	vector<string> lines;
+	case 1017:
+		lazyMode = true;
+		break;
 
-	if (!readTextLines(filename, lines))
-		return false;
+	case 1020:
+		stopEarly = true;
+		break;
 
-	for (const string& line : lines) {
-		vector<string> cols = ParseLineDelim(line);
-		UniValue arr(UniValue::VARR);
+	case 1018:
+		statsWanted = true;
+		statsFile = arg ? arg : "";
+		break;
 
-		for (const string& col : cols) {
-			arr.push_back(col);
+	case 1019:
+		if (arg) {
+			string topStr(arg);
+			if (!isDigitStr(topStr) || topStr.empty()) {
+				fprintf(stderr, "Invalid subtree count %s\n", arg);
+				return EINVAL;
+			}
+			memProfileTop = atoi(arg);
 		}
+		memProfile = true;
+		break;
+
+	case ARGP_KEY_ARG:
+		inputTokens.push_back(arg);
+		break;
 
-		jbody.push_back(arr);
+	case ARGP_KEY_END:
+		break;
+
+	default:
+		return ARGP_ERR_UNKNOWN;
 	}
 
-	return true;
+	return 0;
 }
 
-static void strsplit(const std::string& s_in, const std::string& delim,
-		     std::deque<std::string>& v)
+static bool readJsonFile(const string& filename, UniValue& jbody)
 {
-	char s[s_in.size() + 1];
-	strcpy(s, s_in.c_str());
+	MappedInput in;
+	if (!in.open(filename) ||
+	    !is_valid_utf8(in.data(), in.size()))
+		return false;
 
-	char *p = strtok(s, delim.c_str());
-	while (p != NULL) {
-		v.push_back(p);
-		p = strtok(NULL, delim.c_str());
+	ArenaScope arena;
+	if (!jbody.read(in.data(), in.size())) {
+		fprintf(stderr, "%s: JSON data not valid\n",
+			filename.c_str());
+		return false;
 	}
+
+	return true;
 }
 
-static const UniValue& lookupPath(const string& path, deque<string>& rem,
-				  bool& matched)
+// Walk doc along a compiled path.  If the full path exists, matched
+// is set and the value is returned.  Otherwise the deepest container
+// reached is returned, with path[remPos...] the unresolved remainder.
+static const UniValue& lookupPath(const UniValue& doc, const JsonPath& path,
+				  size_t& remPos, bool& matched)
 {
-	rem.clear();
+	remPos = path.size();
 	matched = false;
 
-	if (!is_valid_utf8(path.c_str()))
-		return NullUniValue;
+	// containers above jptr, for KeyIndexCache invalidation
+	static thread_local vector<const UniValue *> ancestors;
+	ancestors.clear();
 
-	deque<string> tokens;
+	const UniValue* jptr = &doc;
+	for (size_t pos = 0; pos < path.size(); pos++) {
+		const jpathSeg& seg = path[pos];
+		const string& token = *seg.key;
+		bool last = (pos == path.size() - 1);
 
-	strsplit(path, ".", tokens);
+		size_t slot;
 
-	const UniValue* jptr = &jdoc;
-	while (tokens.size() > 0) {
-		const string& token = tokens.front();
+		if (jptr->isObject() &&
+		    objIndex.findKey(*jptr, token, slot, ancestors)) {
+			const UniValue& val = jptr->getValues()[slot];
 
-		if (jptr->isObject() && jptr->exists(token)) {
 			// direct path match
-			if (tokens.size() == 1) {
+			if (last) {
 				matched = true;
-				return (*jptr)[token];
+				return val;
 			}
 
-			if (!(*jptr)[token].isObject() &&
-			    !(*jptr)[token].isArray()) {
-				rem = tokens;
+			if (!val.isObject() && !val.isArray()) {
+				remPos = pos;
 				return *jptr;
 			}
 
-			jptr = &(*jptr)[token];
-			tokens.pop_front();
+			ancestors.push_back(jptr);
+			jptr = &val;
 
-		} else if (jptr->isArray() && isDigitStr(token) &&
-			   ((unsigned long)atol(token.c_str()) < jptr->size())) {
+		} else if (jptr->isArray() && seg.isIndex &&
+			   (seg.index < jptr->size())) {
 
-			size_t index = atol(token.c_str());
+			size_t index = seg.index;
 			// direct path match
-			if (tokens.size() == 1) {
+			if (last) {
 				matched = true;
 				return (*jptr)[index];
 			}
 
 			if (!(*jptr)[index].isObject() &&
 			    !(*jptr)[index].isArray()) {
-				rem = tokens;
+				remPos = pos;
 				return *jptr;
 			}
 
+			ancestors.push_back(jptr);
 			jptr = &(*jptr)[index];
-			tokens.pop_front();
-		} else if (jptr->isArray() && !isDigitStr(token)) {
+		} else if (jptr->isArray() && !seg.isIndex) {
 			return NullUniValue;
 		} else {
-			rem = tokens;
+			remPos = pos;
 			return *jptr;
 		}
 	}
@@ -345,51 +487,123 @@ static const UniValue& lookupPath(const string& path, deque<string>& rem,
 	return *jptr;
 }
 
-const UniValue& jdocGet(const string& jpath)
+const UniValue& jdocGet(const UniValue& doc, const JsonPath& path)
 {
-	deque<string> rem;
+	size_t remPos;
 	bool matched;
 
-	const UniValue& val = lookupPath(jpath, rem, matched);
+	if (!path.valid)
+		return NullUniValue;
+
+	const UniValue& val = lookupPath(doc, path, remPos, matched);
 	if (!matched)
 		return NullUniValue;
 
 	return val;
 }
 
-static bool jdocSet(const string& jpath, const UniValue& jval)
+// Walk val, the value at trie node n, down every branch of the trie
+// below n at once, recording the value reached at each node in hits.
+// Lookups follow lookupPath().
+static void trieWalk(const PathTrie& trie, size_t n, const UniValue& val,
+		     vector<const UniValue *>& hits,
+		     vector<const UniValue *>& ancestors)
+{
+	const PathTrie::node& nd = trie.nodes[n];
+	hits[n] = &val;
+
+	if (!val.isObject() && !val.isArray())
+		return;
+
+	for (size_t c : nd.children) {
+		const jpathSeg& seg = trie.nodes[c].seg;
+		const UniValue *child = nullptr;
+		size_t slot;
+
+		if (val.isObject() &&
+		    objIndex.findKey(val, *seg.key, slot, ancestors))
+			child = &val.getValues()[slot];
+		else if (val.isArray() && seg.isIndex &&
+			 seg.index < val.size())
+			child = &val[seg.index];
+
+		if (child) {
+			ancestors.push_back(&val);
+			trieWalk(trie, c, *child, hits, ancestors);
+			ancestors.pop_back();
+		}
+	}
+}
+
+// get.array, get.object: the result, given each trie node's value
+static void multiGetResult(const editOp& op,
+			   const vector<const UniValue *>& hits,
+			   UniValue& result)
+{
+	bool asObject = (op.cmd->id == CMD_GET_OBJECT);
+	unordered_set<string> keys;
+
+	result = UniValue(asObject ? UniValue::VOBJ : UniValue::VARR);
+	for (size_t i = 0; i < op.pathNames.size(); i++) {
+		size_t n = op.pathNodes[i];
+		const UniValue& val = (n && hits[n]) ? *hits[n] : NullUniValue;
+
+		if (!asObject)
+			result.push_back(val);
+		else if (keys.insert(op.pathNames[i]).second)
+			result.__pushKV(op.pathNames[i], val);
+	}
+}
+
+static void jdocMultiGet(const UniValue& doc, const editOp& op,
+			 UniValue& result)
+{
+	vector<const UniValue *> hits(op.trie.nodes.size());
+	vector<const UniValue *> ancestors;
+
+	trieWalk(op.trie, 0, doc, hits, ancestors);
+	multiGetResult(op, hits, result);
+}
+
+// Add a null value at path, returning it for the caller to fill in
+static UniValue *jdocInsert(UniValue& doc, const JsonPath& path)
 {
-	deque<string> rem;
+	size_t remPos;
 	bool matched;
 
 	UniValue& container =
-		(UniValue&) lookupPath(jpath, rem, matched);
+		(UniValue&) lookupPath(doc, path, remPos, matched);
 
-	if (container.isNull()) {
+	if (container.isNull() || (!matched && remPos == path.size())) {
 		fprintf(stderr, "Invalid json path\n");
-		return false;
+		return nullptr;
 	}
 	if (matched) {
 		fprintf(stderr, "TODO: overwriting values not yet supported\n");
-		return false;
+		return nullptr;
 	}
-	if (rem.size() > 1) {
+	if ((path.size() - remPos) > 1) {
 		fprintf(stderr, "Cannot find json path\n");
-		return false;
+		return nullptr;
 	}
-	assert(rem.size() == 1);	// TODO: create intermediate path objs
+	// TODO: create intermediate path objs
+
+	const jpathSeg& lastSeg = path[remPos];
+
+	const UniValue *oldValues = container.getValues().data();
 
 	if (container.isObject()) {
-		const string& key = rem.front();
-		container.pushKV(key, jval);
+		// lookupPath() established the key is absent
+		container.__pushKV(*lastSeg.key, NullUniValue);
+		objIndex.noteAppend(container,
+				    container.getValues().data() != oldValues);
 
 	} else if (container.isArray()) {
-		const string& indexStr = rem.front();
-		if (!isDigitStr(indexStr)) {
+		if (!lastSeg.isIndex) {
 			fprintf(stderr,"Invalid array index\n");
-			return false;
+			return nullptr;
 		}
-		unsigned int index = (unsigned int) atoi(indexStr.c_str());
+		size_t index = lastSeg.index;
 
 		assert(index >= container.size());
 
@@ -400,312 +614,1704 @@ static bool jdocSet(const string& jpath, const UniValue& jval)
 		assert(index == container.size());
 
 		// add new item
-		container.push_back(jval);
+		container.push_back(NullUniValue);
+
+		if (container.getValues().data() != oldValues)
+			objIndex.noteAppend(container, true);
 	}
 
 	else {
 		assert(0 && "Unexpected container type");
 	}
 
-	return true;
+	return (UniValue *) &container.getValues().back();
 }
 
-static bool readInput()
+static bool jdocSet(UniValue& doc, const JsonPath& path, const UniValue& jval)
 {
-	string rawBody;
-
-	if (!readStringFd(STDIN_FILENO, rawBody))
+	UniValue *slot = jdocInsert(doc, path);
+	if (!slot)
 		return false;
 
-	if (!jdoc.read(rawBody)) {
-		fprintf(stderr, "(stdin): Invalid JSON input\n");
-		return false;
-	}
-
+	*slot = jval;
 	return true;
 }
 
-regex rxTrue("^\\s*true\\s*$", regex::ECMAScript | regex::icase);
-regex rxFalse("^\\s*false\\s*$", regex::ECMAScript | regex::icase);
-regex rxNull("^\\s*null\\s*$", regex::ECMAScript | regex::icase);
-regex rxArray("\\s*\\[[^\\[]*\\]\\s*", regex::ECMAScript);
-regex rxObject("\\s*\\{[^\\[]*\\}\\s*", regex::ECMAScript);
-
-static void detectAndSet(const string& s, UniValue& jval)
+// Transfer src into dst without a deep copy, leaving src null.
+// UniValue has no move support, so swap the underlying storage.
+static void moveValue(UniValue& dst, UniValue& src)
 {
-	// empty string = string type
-	if (s.size() == 0)
-		jval.setStr("");
-
-	// match fixed string to bool/null/arr/obj
-	else if (regex_match(s, rxTrue))
-		jval.setBool(true);
-	else if (regex_match(s, rxFalse))
-		jval.setBool(false);
-	else if (regex_match(s, rxNull))
-		jval.setNull();
-	else if (regex_match(s, rxArray))
-		jval.setArray();
-	else if (regex_match(s, rxObject))
-		jval.setObject();
+	switch (src.getType()) {
+	case UniValue::VOBJ:
+		dst = UniValue(UniValue::VOBJ);
+		((vector<string>&) dst.getKeys()).swap(
+			(vector<string>&) src.getKeys());
+		((vector<UniValue>&) dst.getValues()).swap(
+			(vector<UniValue>&) src.getValues());
+		break;
+	case UniValue::VARR:
+		dst = UniValue(UniValue::VARR);
+		((vector<UniValue>&) dst.getValues()).swap(
+			(vector<UniValue>&) src.getValues());
+		break;
+	case UniValue::VSTR:
+		dst = UniValue(UniValue::VSTR);
+		((string&) dst.getValStr()).swap((string&) src.getValStr());
+		break;
+	default:
+		dst = src;
+		break;
+	}
 
-	// attempt to validate-and-set as JSON number.
-	// if that fails, assume string value.
-	else if (!jval.setNumStr(s))
-		jval.setStr(s);
+	src.setNull();
 }
 
-static bool processDocument()
+// Move the elements of arr selected by slice into out, a new array
+static void sliceTake(UniValue& arr, const jpathSlice& slice, UniValue& out)
 {
-	while (inputTokens.size() > 0) {
-		// pop next token
-		const string cmd = inputTokens.front();
-		inputTokens.pop_front();
-
-		// lookup command in command map
-		if (!cmdMap.count(cmd)) {
-			fprintf(stderr, "Unknown command %s\n", cmd.c_str());
-			return false;
-		}
-
-		// arg count validation
-		const commandInfo& cmdInfo = cmdMap[cmd];
-		if (inputTokens.size() < cmdInfo.n_args) {
-			fprintf(stderr, "Command %s missing arguments\n",
-				cmd.c_str());
-			return false;
-		}
-
-		// arg collection
-		vector<string> cmdArgs;
-		for (unsigned int i = 0; i < cmdInfo.n_args; i++) {
-			const string tok = inputTokens.front();
-			inputTokens.pop_front();
-			cmdArgs.push_back(tok);
-		}
-
-		// per-command processing
-
-		if (cmd == "get") {
-			assert(cmdArgs.size() == 1);
-			UniValue val = jdocGet(cmdArgs[0]);
-			jdoc = val;
-		}
+	vector<UniValue>& from = (vector<UniValue>&) arr.getValues();
+	size_t first, count;
+	slice.bounds(from.size(), first, count);
+
+	out = UniValue(UniValue::VARR);
+	vector<UniValue>& to = (vector<UniValue>&) out.getValues();
+	to.resize(count);
+	for (size_t i = 0; i < count; i++)
+		moveValue(to[i], from[first + i * slice.step]);
+}
 
-		else if (cmd == "new") {
-			assert(cmdArgs.size() == 0);
-			UniValue tmp(UniValue::VOBJ);
-			jdoc = tmp;
+// "get": replace doc with the value at path, or with the elements
+// selected by a final slice, moved out rather than copied
+static void jdocTake(UniValue& doc, const JsonPath& path)
+{
+	UniValue val;
+
+	if (path.valid && path.sliced()) {
+		JsonPath parent(path);
+		parent.segs.pop_back();
+
+		size_t remPos;
+		bool matched = parent.empty();
+		UniValue *arr = &doc;
+		if (!matched)
+			arr = (UniValue *) &lookupPath(doc, parent, remPos,
+						       matched);
+
+		if (matched && arr->isArray()) {
+			sliceTake(*arr, path.segs.back().slice, val);
+			moveValue(doc, val);
+			return;
 		}
+		// anything else is looked up by the segment's key text
+	}
 
-		else if (cmd == "newarray") {
-			assert(cmdArgs.size() == 0);
-			UniValue tmp(UniValue::VARR);
-			jdoc = tmp;
-		}
+	const UniValue& found = jdocGet(doc, path);
+	if (&found != &NullUniValue)
+		moveValue(val, (UniValue&) found);
+	moveValue(doc, val);
+}
 
-		else if (cmd == "set") {
-			assert(cmdArgs.size() == 2);
-			const string& jpath = cmdArgs[0];
-			const string& val = cmdArgs[1];
+// jdocSet() for a temporary value, which is consumed
+static bool jdocSetMove(UniValue& doc, const JsonPath& path, UniValue& jval)
+{
+	UniValue *slot = jdocInsert(doc, path);
+	if (!slot)
+		return false;
 
-			UniValue jval;
-			detectAndSet(val, jval);
+	moveValue(*slot, jval);
+	return true;
+}
 
-			if (!jdocSet(jpath, jval))
-				return false;
-		}
+// The part of path below spot, relative to the container's additions
+static void additionPath(const JsonPath& path, const JsonSpot& spot,
+			 JsonPath& rest)
+{
+	rest.valid = true;
+	rest.segs.assign(path.segs.begin() + spot.depth, path.segs.end());
+	if (spot.type == '[' && rest.segs[0].isIndex)
+		rest.segs[0].index -= spot.count;
+}
 
-		else if (cmd == "str") {
-			assert(cmdArgs.size() == 2);
-			const string& jpath = cmdArgs[0];
-			const string& val = cmdArgs[1];
+// jdocInsert() for a document held as raw text, where path ends at
+// spot.  The new slot goes among the additions to the container the
+// path lands in, where later commands may extend it further.
+static UniValue *spotInsert(const JsonSpot& spot, tapeAdditions& added,
+			    const JsonPath& path)
+{
+	bool isObject = (spot.type == '{');
+	bool isArray = (spot.type == '[');
 
-			if (!is_valid_utf8(val.c_str())) {
-				fprintf(stderr, "string not UTF8: %s\n",
-					val.c_str());
-				return false;
-			}
+	// as jdocInsert() reports them, a null match included
+	if (path.empty() || (spot.depth == 0 && !isObject && !isArray) ||
+	    (spot.matched && spot.type == 'n')) {
+		fprintf(stderr, "Invalid json path\n");
+		return nullptr;
+	}
+	if (spot.matched) {
+		fprintf(stderr, "TODO: overwriting values not yet supported\n");
+		return nullptr;
+	}
+	if (isArray && !path[spot.depth].isIndex) {
+		fprintf(stderr, "Invalid json path\n");
+		return nullptr;
+	}
+	if (!isObject && !isArray) {
+		fprintf(stderr, "Cannot find json path\n");
+		return nullptr;
+	}
 
-			UniValue jval(val);
-			if (!jdocSet(jpath, jval))
-				return false;
-		}
+	UniValue& extra = added[spot.start];
+	if (extra.isNull())
+		extra = UniValue(isObject ? UniValue::VOBJ : UniValue::VARR);
 
-		else if (cmd == "int") {
-			assert(cmdArgs.size() == 2);
-			const string& jpath = cmdArgs[0];
-			const string& valStr = cmdArgs[1];
+	JsonPath rest;
+	additionPath(path, spot, rest);
+	return jdocInsert(extra, rest);
+}
 
-			errno = 0;
-			unsigned long long l = strtoull(valStr.c_str(),
-							NULL, 10);
-			if (errno != 0) {
-				fprintf(stderr, "integer parse failed: %s\n",
-					valStr.c_str());
-				return false;
-			}
+static bool readInput()
+{
+	MappedInput in;
 
-			UniValue jval((uint64_t) l);
-			if (!jdocSet(jpath, jval))
-				return false;
-		}
+	StatsTimer readTime(jupStats, "read");
+	if (!in.openFd(STDIN_FILENO, "(stdin)"))
+		return false;
+	readTime.bytes(in.size(), 0);
+	readTime.stop();
 
-		else if (cmd == "num") {
-			assert(cmdArgs.size() == 2);
-			const string& jpath = cmdArgs[0];
-			const string& valStr = cmdArgs[1];
+	StatsTimer parseTime(jupStats, "parse");
+	parseTime.bytes(in.size(), 0);
 
-			errno = 0;
-			double d = strtold(valStr.c_str(), NULL);
-			if (errno != 0) {
-				fprintf(stderr, "number parse failed: %s\n",
-					valStr.c_str());
-				return false;
-			}
+	ArenaScope arena;
+	if (!jdoc.read(in.data(), in.size())) {
+		fprintf(stderr, "(stdin): Invalid JSON input\n");
+		return false;
+	}
 
-			UniValue jval(d);
-			if (!jdocSet(jpath, jval))
-				return false;
-		}
+	return true;
+}
 
-		else if (cmd == "true" || cmd == "false" || cmd == "null") {
-			assert(cmdArgs.size() == 1);
-			UniValue jval;
-			if (cmd == "true")	jval.setBool(true);
-			else if (cmd == "false") jval.setBool(false);
+// A command line consisting only of "get" commands, optionally ending
+// with get.array or get.object, is answered by a streaming scan of
+// stdin.  Consecutive gets compose into one path; multi is set to the
+// final multi-path get, if any.
+static bool streamGetPath(JsonPath& path, const editOp *& multi)
+{
+	path = JsonPath();
+	path.valid = true;
+	multi = nullptr;
 
-			if (!jdocSet(cmdArgs[0], jval))
-				return false;
-		}
+	if (linesMode || program.empty())
+		return false;
 
-		else if (cmd == "array" || cmd == "object") {
-			assert(cmdArgs.size() == 1);
-			UniValue jval(cmd == "object" ? UniValue::VOBJ : UniValue::VARR);
+	for (const editOp& op : program) {
+		// a slice selects from the array at its prefix, not below it
+		if (multi || path.sliced())
+			return false;
 
-			if (!jdocSet(cmdArgs[0], jval))
+		if (isMultiGet(op.cmd->id)) {
+			// at least one path must be able to match
+			if (op.trie.nodes.size() < 2)
 				return false;
+			multi = &op;
+			continue;
 		}
 
-		else if (cmd == "file.text") {
-			assert(cmdArgs.size() == 2);
-			const string& jpath = cmdArgs[0];
-			const string& filename = cmdArgs[1];
-			string body;
-
-			if (!readTextFile(filename, body))
-				return false;
+		if (op.cmd->id != CMD_GET || !op.path.valid || op.path.empty())
+			return false;
 
-			UniValue jval(body);
-			if (!jdocSet(jpath, jval))
-				return false;
-		}
+		path.append(op.path);
+	}
 
-		else if (cmd == "file.csv") {
-			assert(cmdArgs.size() == 2);
-			const string& jpath = cmdArgs[0];
-			const string& filename = cmdArgs[1];
-			UniValue jbody(UniValue::VARR);
+	// the scanner takes only slices it can select in one pass
+	return !path.sliced() || path.segs.back().slice.forward();
+}
 
-			if (!readDelimFile(filename, jbody) ||
-			    !jdocSet(jpath, jbody))
-				return false;
-		}
+// Streamed get.array/get.object: each captured value is parsed, and
+// the paths running on below it resolved within it
+static bool readInputMultiGet(const JsonPath& prefix, const editOp& op)
+{
+	JsonScanner scan;
+	vector<string> raw;
+	vector<bool> found;
 
-		else if (cmd == "file.json") {
-			assert(cmdArgs.size() == 2);
-			const string& jpath = cmdArgs[0];
-			const string& filename = cmdArgs[1];
-			UniValue jbody;
+	StatsTimer readTime(jupStats, "read");
+	if (!scan.openFd(STDIN_FILENO, "(stdin)"))
+		return false;
+	scan.stopEarly(stopEarly);
 
-			if (!readJsonFile(filename, jbody) ||
-			    !jdocSet(jpath, jbody))
-				return false;
-		}
+	bool ok = scan.findPaths(prefix, op.trie, raw, found);
+	readTime.bytes(scan.consumed(), 0);
+	readTime.stop();
 
-		else if (cmd == "file.hex" || cmd == "file.base64") {
-			assert(cmdArgs.size() == 2);
-			const string& jpath = cmdArgs[0];
-			const string& filename = cmdArgs[1];
-			string rawBody;
+	StatsTimer parseTime(jupStats, "parse");
 
-			if (!readBinaryFile(filename, rawBody))
-				return false;
+	const PathTrie& trie = op.trie;
+	vector<UniValue> values(trie.nodes.size());
+	vector<const UniValue *> hits(trie.nodes.size());
+	vector<const UniValue *> ancestors;
+	uint64_t parsed = 0;
 
-			string body;
-			if (cmd == "file.hex")
-				body = HexStr(rawBody.begin(), rawBody.end());
-			else
-				body = EncodeBase64(rawBody);
+	for (size_t n = 0; ok && n < trie.nodes.size(); n++) {
+		if (!found[n])
+			continue;
 
-			UniValue jval(body);
-			if (!jdocSet(jpath, jval))
-				return false;
-		}
+		parsed += raw[n].size();
+		ok = values[n].read(raw[n]);
+		if (ok)
+			trieWalk(trie, n, values[n], hits, ancestors);
+	}
+	parseTime.bytes(parsed, 0);
 
-		else {
-			// should never be reached
-			assert(0 && "unhandled command trap");
-		}
+	if (!ok) {
+		fprintf(stderr, "(stdin): Invalid JSON input\n");
+		return false;
 	}
 
+	multiGetResult(op, hits, jdoc);
+	objIndex.clear();
 	return true;
 }
 
-static bool writeOutput()
+static bool readInputGet(const JsonPath& path)
 {
-	if (jdoc.isStr()) {
-		const string& val = jdoc.getValStr();
-
-		if (optDecodeMode == DecHex) {
-			vector<unsigned char> buf = ParseHex(val);
-			if (buf.size() != (val.size() / 2)) {
-				fprintf(stderr, "Hex decode failed\n");
-				return false;
-			}
-
-			// todo: remove unneeded buffer copy
-
-			string bufStr(buf.begin(), buf.end());
-			return writeStringFd(STDOUT_FILENO, bufStr);
-		} else if (optDecodeMode == DecBase64) {
-			bool invalid = false;
-			vector<unsigned char> buf =
-				DecodeBase64(val.c_str(), &invalid);
-			if (invalid) {
-				fprintf(stderr, "Base64 decode failed\n");
-				return false;
-			}
+	JsonScanner scan;
+	string rawValue;
+	bool found;
 
-			// todo: remove unneeded buffer copy
+	// with --stop-early, the scan reads only as far as the value
+	StatsTimer readTime(jupStats, "read");
+	if (!scan.openFd(STDIN_FILENO, "(stdin)"))
+		return false;
+	scan.stopEarly(stopEarly);
 
-			string bufStr(buf.begin(), buf.end());
-			return writeStringFd(STDOUT_FILENO, bufStr);
+	bool ok = scan.findPath(path, found, rawValue);
+	readTime.bytes(scan.consumed(), 0);
+	readTime.stop();
 
-		} else {
-			assert(optDecodeMode == DecNone);
+	StatsTimer parseTime(jupStats, "parse");
+	parseTime.bytes(rawValue.size(), 0);
 
-			return writeStringFd(STDOUT_FILENO, val);
-		}
+	if (!ok || (found && !jdoc.read(rawValue))) {
+		fprintf(stderr, "(stdin): Invalid JSON input\n");
+		return false;
 	}
 
-	string rawBody = jdoc.write(minimalJson ? 0 : defaultIndent);
-	rawBody.append("\n");
+	if (!found)
+		jdoc.setNull();
 
-	return writeStringFd(STDOUT_FILENO, rawBody);
+	return true;
 }
 
-static bool ignoreStdin()
+enum valueKind { VK_STRING, VK_TRUE, VK_FALSE, VK_NULL, VK_ARRAY, VK_OBJECT };
+
+// case-insensitive compare of [p, end) against lowercase keyword
+static bool matchKeyword(const char *p, const char *end, const char *kw)
 {
-	const string& firstCmd = inputTokens.size() ? inputTokens[0] : "";
+	size_t len = strlen(kw);
+	if ((size_t)(end - p) != len)
+		return false;
 
-	if (cmdMap.count(firstCmd) > 0) {
-		const commandInfo& ci = cmdMap[firstCmd];
-		if (ci.ignoreStdin)
-			return true;
-	}
+	for (size_t i = 0; i < len; i++)
+		if (tolower((unsigned char) p[i]) != kw[i])
+			return false;
 
-	return false;
+	return true;
+}
+
+// Single-pass classifier for "set" values.  Whitespace-trimmed,
+// case-insensitive true/false/null; "[...]" with no inner '[' is an
+// array and "{...}" with no inner '[' is an object.
+static valueKind classifyValue(const string& s)
+{
+	const char *p = s.data();
+	const char *end = p + s.size();
+
+	while (p < end && isspace((unsigned char) *p))
+		p++;
+	while (end > p && isspace((unsigned char) end[-1]))
+		end--;
+
+	if (p == end)
+		return VK_STRING;
+
+	switch (*p) {
+	case 't': case 'T':
+		return matchKeyword(p, end, "true") ? VK_TRUE : VK_STRING;
+	case 'f': case 'F':
+		return matchKeyword(p, end, "false") ? VK_FALSE : VK_STRING;
+	case 'n': case 'N':
+		return matchKeyword(p, end, "null") ? VK_NULL : VK_STRING;
+	case '[':
+	case '{': {
+		char close = (*p == '[') ? ']' : '}';
+		if ((end - p) < 2 || end[-1] != close ||
+		    memchr(p + 1, '[', (end - p) - 2) != nullptr)
+			return VK_STRING;
+		return (close == ']') ? VK_ARRAY : VK_OBJECT;
+	}
+	default:
+		return VK_STRING;
+	}
+}
+
+static void detectAndSet(const string& s, UniValue& jval)
+{
+	// empty string = string type
+	if (s.size() == 0) {
+		jval.setStr("");
+		return;
+	}
+
+	// match fixed string to bool/null/arr/obj
+	switch (classifyValue(s)) {
+	case VK_TRUE:	jval.setBool(true); break;
+	case VK_FALSE:	jval.setBool(false); break;
+	case VK_NULL:	jval.setNull(); break;
+	case VK_ARRAY:	jval.setArray(); break;
+	case VK_OBJECT:	jval.setObject(); break;
+
+	// attempt to validate-and-set as JSON number.
+	// if that fails, assume string value.
+	case VK_STRING:
+		if (!jval.setNumStr(s))
+			jval.setStr(s);
+		break;
+	}
+}
+
+// --csv-types: how a cell would be stored by detectAndSet()
+enum cellKind {
+	CELL_STR	= (1U << 0),
+	CELL_NUM	= (1U << 1),
+	CELL_TRUE	= (1U << 2),
+	CELL_FALSE	= (1U << 3),
+	CELL_NULL	= (1U << 4),
+
+	CELL_BOOL	= CELL_TRUE | CELL_FALSE,
+};
+
+// probe.setNumStr(s) is tried on cells that may be numbers, so it
+// holds the number when CELL_NUM is returned
+static unsigned int classifyCell(const string& s, UniValue& probe)
+{
+	if (s.empty())
+		return CELL_STR;
+
+	switch (classifyValue(s)) {
+	case VK_TRUE:
+		return CELL_TRUE;
+	case VK_FALSE:
+		return CELL_FALSE;
+	case VK_NULL:
+		return CELL_NULL;
+	case VK_STRING:
+		return probe.setNumStr(s) ? CELL_NUM : CELL_STR;
+	default:
+		return CELL_STR;	// no containers from CSV cells
+	}
+}
+
+// Type each column whose cells all agree (nulls allowed anywhere);
+// mixed columns stay strings.  A first pass over csv, which is left
+// rewound; returns cellKind bits per column.
+static vector<unsigned int> csvColumnKinds(CsvReader& csv)
+{
+	vector<CsvField> fields;
+	vector<unsigned int> seen;
+	size_t candidates = 0;
+	UniValue probe;
+	string cell;
+	bool first = true;
+
+	while (csv.next(fields)) {
+		// with a header, every column is known up front
+		if (csvHeader && first) {
+			seen.resize(fields.size());
+			candidates = fields.size();
+			first = false;
+			continue;
+		}
+
+		for (size_t j = seen.size(); j < fields.size(); j++) {
+			seen.push_back(0);
+			candidates++;
+		}
+
+		for (size_t j = 0; j < fields.size(); j++) {
+			if (seen[j] & CELL_STR)
+				continue;
+
+			cell.assign(fields[j].data, fields[j].len);
+			seen[j] |= classifyCell(cell, probe);
+			if ((seen[j] & CELL_STR) ||
+			    ((seen[j] & CELL_NUM) && (seen[j] & CELL_BOOL))) {
+				seen[j] |= CELL_STR;
+				candidates--;
+			}
+		}
+
+		// ragged rows may still add columns, so no early exit
+		// unless the header fixed them
+		if (candidates == 0 && csvHeader)
+			break;
+	}
+
+	csv.rewind();
+	return seen;
+}
+
+// Store a cell of a typed column, built as a string, as its type
+static void typeCsvCell(UniValue& cell, string& tmp)
+{
+	tmp.swap((string&) cell.getValStr());
+	switch (classifyCell(tmp, cell)) {
+	case CELL_TRUE:
+		cell.setBool(true);
+		break;
+	case CELL_FALSE:
+		cell.setBool(false);
+		break;
+	case CELL_NULL:
+		cell.setNull();
+		break;
+	case CELL_NUM:
+		break;		// set by classifyCell()
+	default:
+		tmp.swap((string&) cell.getValStr());
+		break;
+	}
+}
+
+static bool readDelimFile(const string& filename, UniValue& jbody)
+{
+	if (!jbody.isArray()) {
+		fprintf(stderr, "Input not an array\n");
+		return false;
+	}
+
+	CsvReader csv;
+	if (!csv.open(filename))
+		return false;
+
+	vector<unsigned int> kinds;
+	if (csvTypes)
+		kinds = csvColumnKinds(csv);
+
+	// rows and fields are built in place, not copied in
+	vector<UniValue>& rows = (vector<UniValue>&) jbody.getValues();
+	vector<CsvField> fields;
+	vector<string> header;
+	string tmp;
+	unsigned long recNo = 0;
+
+	while (csv.next(fields)) {
+		recNo++;
+
+		if (csvHeader && recNo == 1) {
+			unordered_set<string> names;
+			for (const CsvField& f : fields) {
+				header.emplace_back(f.data, f.len);
+				if (!names.insert(header.back()).second) {
+					fprintf(stderr, "%s: duplicate column name \"%s\" in header\n",
+						filename.c_str(),
+						header.back().c_str());
+					return false;
+				}
+			}
+			continue;
+		}
+
+		if (csvHeader && fields.size() > header.size()) {
+			fprintf(stderr, "%s: record %lu has more fields than the header\n",
+				filename.c_str(), recNo);
+			return false;
+		}
+
+		rows.emplace_back(csvHeader ? UniValue::VOBJ : UniValue::VARR);
+		UniValue& row = rows.back();
+		vector<UniValue>& cols = (vector<UniValue>&) row.getValues();
+
+		if (csvHeader) {
+			// every row gets the header's keys; short rows are
+			// padded with nulls
+			(vector<string>&) row.getKeys() = header;
+			cols.reserve(header.size());
+		} else
+			cols.reserve(fields.size());
+
+		for (size_t j = 0; j < fields.size(); j++) {
+			cols.emplace_back(UniValue::VSTR);
+			((string&) cols.back().getValStr()).assign(
+				fields[j].data, fields[j].len);
+
+			if (j < kinds.size() && kinds[j] &&
+			    !(kinds[j] & CELL_STR))
+				typeCsvCell(cols.back(), tmp);
+		}
+
+		if (csvHeader)
+			cols.resize(header.size());
+	}
+
+	return true;
+}
+
+// Split a get.array/get.object argument into paths, and merge them
+// into the op's trie.  As with get, a path that is not UTF-8 or is
+// empty yields null.
+static void compileMultiGet(editOp& op)
+{
+	const string& list = op.args[0];
+	size_t pos = 0;
+
+	while (1) {
+		size_t comma = list.find(',', pos);
+		if (comma == string::npos)
+			comma = list.size();
+
+		JsonPath path;
+		op.pathNames.push_back(list.substr(pos, comma - pos));
+		op.pathNodes.push_back(path.compile(op.pathNames.back()) &&
+				       !path.empty() ? op.trie.add(path) : 0);
+
+		if (comma == list.size())
+			break;
+		pos = comma + 1;
+	}
+}
+
+static bool compileProgram()
+{
+	program.clear();
+
+	size_t tokPos = 0;
+	while (tokPos < inputTokens.size()) {
+		// next token
+		const string& cmd = inputTokens[tokPos++];
+
+		// lookup command in command table
+		const commandInfo *ci = lookupCommand(cmd);
+		if (!ci) {
+			fprintf(stderr, "Unknown command %s\n", cmd.c_str());
+			return false;
+		}
+
+		// arg count validation
+		if ((inputTokens.size() - tokPos) < ci->n_args) {
+			fprintf(stderr, "Command %s missing arguments\n",
+				cmd.c_str());
+			return false;
+		}
+
+		editOp op;
+		op.cmd = ci;
+
+		// arg collection
+		for (unsigned int i = 0; i < ci->n_args; i++)
+			op.args.push_back(inputTokens[tokPos++]);
+
+		// all commands with arguments take a JSON-PATH first
+		if (ci->n_args > 0 && !isMultiGet(ci->id)) {
+			if (!op.path.compile(op.args[0]) &&
+			    ci->id != CMD_GET) {
+				fprintf(stderr, "Invalid json path\n");
+				return false;
+			}
+		}
+
+		// per-command literal values
+
+		switch (ci->id) {
+		case CMD_SET:
+			detectAndSet(op.args[1], op.value);
+			break;
+
+		case CMD_STR: {
+			const string& val = op.args[1];
+			if (!is_valid_utf8(val.data(), val.size())) {
+				fprintf(stderr, "string not UTF8: %s\n",
+					val.c_str());
+				return false;
+			}
+			op.value.setStr(val);
+			break;
+		}
+
+		case CMD_INT: {
+			const string& valStr = op.args[1];
+
+			errno = 0;
+			unsigned long long l = strtoull(valStr.c_str(),
+							NULL, 10);
+			if (errno != 0) {
+				fprintf(stderr, "integer parse failed: %s\n",
+					valStr.c_str());
+				return false;
+			}
+
+			op.value = UniValue((uint64_t) l);
+			break;
+		}
+
+		case CMD_NUM: {
+			const string& valStr = op.args[1];
+
+			errno = 0;
+			double d = strtold(valStr.c_str(), NULL);
+			if (errno != 0) {
+				fprintf(stderr, "number parse failed: %s\n",
+					valStr.c_str());
+				return false;
+			}
+
+			op.value = UniValue(d);
+			break;
+		}
+
+		case CMD_TRUE:
+			op.value.setBool(true);
+			break;
+		case CMD_FALSE:
+			op.value.setBool(false);
+			break;
+		case CMD_NULL:
+			op.value.setNull();
+			break;
+		case CMD_ARRAY:
+			op.value.setArray();
+			break;
+		case CMD_OBJECT:
+			op.value.setObject();
+			break;
+
+		case CMD_GET_ARRAY:
+		case CMD_GET_OBJECT:
+			compileMultiGet(op);
+			break;
+
+		default:
+			break;
+		}
+
+		program.push_back(op);
+	}
+
+	return true;
+}
+
+// Value to store for one of the file.* commands
+static bool readFileValue(const editOp& op, UniValue& jval)
+{
+	const string& filename = op.args[1];
+	string body;
+
+	switch (op.cmd->id) {
+	case CMD_FILE_TEXT:
+		if (!readTextFile(filename, body))
+			return false;
+		break;
+
+	case CMD_FILE_CSV:
+		jval.setArray();
+		return readDelimFile(filename, jval);
+
+	case CMD_FILE_JSON:
+		return readJsonFile(filename, jval);
+
+	case CMD_FILE_HEX:
+	case CMD_FILE_BASE64: {
+		MappedInput in;
+
+		if (!in.open(filename))
+			return false;
+
+		// encode straight from the mapping
+		const unsigned char *raw = (const unsigned char *) in.data();
+		if (op.cmd->id == CMD_FILE_HEX)
+			body = HexStr(raw, raw + in.size());
+		else
+			body = EncodeBase64(raw, in.size());
+		break;
+	}
+
+	default:
+		assert(0 && "Not a file command");
+		return false;
+	}
+
+	jval = UniValue(UniValue::VSTR);
+	((string&) jval.getValStr()).swap(body);
+	return true;
+}
+
+// Time one command for --stats.  File commands count the file as input.
+static void timeCommand(StatsTimer& t, const editOp& op)
+{
+	if (!jupStats.phasesOn())
+		return;
+
+	t.command(op.cmd->name, op.args.empty() ? "" : op.args[0]);
+
+	struct stat st;
+	switch (op.cmd->id) {
+	case CMD_FILE_TEXT:
+	case CMD_FILE_JSON:
+	case CMD_FILE_HEX:
+	case CMD_FILE_BASE64:
+	case CMD_FILE_CSV:
+		if (stat(op.args[1].c_str(), &st) == 0)
+			t.bytes(st.st_size, 0);
+		break;
+	default:
+		break;
+	}
+}
+
+// Run the program, from command first on, against doc
+static bool processDocument(UniValue& doc, size_t first = 0)
+{
+	// the program is not consumed, so it may be re-run against each
+	// record in --lines mode
+	objIndex.clear();
+
+	for (size_t i = first; i < program.size(); i++) {
+		const editOp& op = program[i];
+		StatsTimer t(jupStats, "command");
+		timeCommand(t, op);
+
+		switch (op.cmd->id) {
+
+		case CMD_GET:
+			jdocTake(doc, op.path);
+			objIndex.clear();
+			break;
+
+		case CMD_GET_ARRAY:
+		case CMD_GET_OBJECT: {
+			UniValue val;
+			jdocMultiGet(doc, op, val);
+			doc = val;
+			objIndex.clear();
+			break;
+		}
+
+		case CMD_NEW:
+			doc.setObject();
+			objIndex.clear();
+			break;
+
+		case CMD_NEWARRAY:
+			doc.setArray();
+			objIndex.clear();
+			break;
+
+		case CMD_SET:
+		case CMD_STR:
+		case CMD_INT:
+		case CMD_NUM:
+		case CMD_TRUE:
+		case CMD_FALSE:
+		case CMD_NULL:
+		case CMD_ARRAY:
+		case CMD_OBJECT:
+			if (!jdocSet(doc, op.path, op.value))
+				return false;
+			break;
+
+		case CMD_FILE_TEXT:
+		case CMD_FILE_JSON:
+		case CMD_FILE_HEX:
+		case CMD_FILE_BASE64:
+		case CMD_FILE_CSV: {
+			UniValue jval;
+
+			if (!readFileValue(op, jval) ||
+			    !jdocSetMove(doc, op.path, jval))
+				return false;
+			break;
+		}
+		}
+	}
+
+	return true;
+}
+
+// Write doc as the final output: raw (optionally decoded) for a top
+// level string, else JSON text
+static bool writeDocument(FdWriter& out, const UniValue& doc)
+{
+	if (doc.isStr()) {
+		const string& val = doc.getValStr();
+
+		if (optDecodeMode == DecHex) {
+			const char *p = val.data();
+			const char *end = p + val.size();
+			if (ParseHexLength(p, end) != (val.size() / 2)) {
+				fprintf(stderr, "Hex decode failed\n");
+				return false;
+			}
+
+			// decode straight into the output buffer
+			size_t avail;
+			while (p < end) {
+				unsigned char *dst =
+					(unsigned char *) out.reserve(1, avail);
+				size_t n = ParseHexChunk(p, end, dst, avail);
+				if (n == 0)
+					break;
+				out.commit(n);
+			}
+
+			return out.flush();
+		} else if (optDecodeMode == DecBase64) {
+			bool invalid = false;
+			size_t n = DecodeBase64Length(val.data(), val.size(),
+						      &invalid);
+			if (invalid) {
+				fprintf(stderr, "Base64 decode failed\n");
+				return false;
+			}
+
+			// decode whole 4-char groups straight into the
+			// output buffer; any short group comes last
+			const char *p = val.data();
+			size_t avail;
+			while (n > 0) {
+				unsigned char *dst =
+					(unsigned char *) out.reserve(3, avail);
+				size_t chunk = (avail / 3) * 4;
+				if (chunk > n)
+					chunk = n;
+				out.commit(DecodeBase64Block(p, chunk, dst));
+				p += chunk;
+				n -= chunk;
+			}
+
+			return out.flush();
+
+		} else {
+			assert(optDecodeMode == DecNone);
+
+			out.append(val);
+			return out.flush();
+		}
+	}
+
+	writeJson(out, doc, minimalJson ? 0 : defaultIndent);
+	out.push('\n');
+
+	return out.flush();
+}
+
+// Write out.  For --stats, time spent in write(2) is reported as
+// the output phase and the rest as serialization.
+static bool writeTimed(FdWriter& out, const function<bool()>& writeFn)
+{
+	StatsClock io;
+	StatsTimer t(jupStats, "serialize");
+	if (jupStats.phasesOn())
+		out.timeWrites(&io);
+
+	bool ok = writeFn();
+
+	t.exclude(io);
+	t.bytes(0, out.bytesWritten());
+	t.stop();
+
+	StatsPhase ph;
+	ph.name = "output";
+	ph.time = io;
+	ph.bytesIn = 0;
+	ph.bytesOut = out.bytesWritten();
+	jupStats.add(ph);
+
+	return ok;
+}
+
+static bool writeOutput()
+{
+	jupStats.document(jdoc);
+
+	FdWriter out(STDOUT_FILENO);
+	return writeTimed(out, [&out] { return writeDocument(out, jdoc); });
+}
+
+// --lazy get.array/get.object: each path is resolved on the index and
+// only its value parsed.  With additions pending, the document is
+// instead written out with them and reparsed.
+static bool lazyMultiGet(const JsonTape& tape, size_t root,
+			 const tapeAdditions& added, const editOp& op)
+{
+	const PathTrie& trie = op.trie;
+
+	if (!added.empty()) {
+		string text;
+		UniValue doc;
+
+		if (tape.check(root)) {
+			FdWriter out(text);
+			tape.write(out, root, 0, added);
+		}
+		if (text.empty() || !doc.read(text)) {
+			fprintf(stderr, "(stdin): Invalid JSON input\n");
+			return false;
+		}
+
+		objIndex.clear();
+		jdocMultiGet(doc, op, jdoc);
+		objIndex.clear();
+		return true;
+	}
+
+	vector<UniValue> values(trie.nodes.size());
+	vector<const UniValue *> hits(trie.nodes.size());
+
+	for (size_t n : op.pathNodes) {
+		if (!n || hits[n])
+			continue;
+
+		JsonPath path;
+		path.valid = true;
+		for (size_t m = n; m; m = trie.nodes[m].parent)
+			path.segs.insert(path.segs.begin(), trie.nodes[m].seg);
+
+		JsonSpot spot;
+		if (!tape.findSpot(root, path, spot) ||
+		    (spot.matched && !tape.materialize(spot.start, values[n]))) {
+			fprintf(stderr, "(stdin): Invalid JSON input\n");
+			return false;
+		}
+		if (spot.matched)
+			hits[n] = &values[n];
+	}
+
+	multiGetResult(op, hits, jdoc);
+	return true;
+}
+
+// Lazy "get" of a sliced path: only the value the slice applies to is
+// parsed, unless there are additions to merge
+static bool lazySlice(const JsonTape& tape, size_t root,
+		      const tapeAdditions& added, const JsonPath& path)
+{
+	JsonPath parent(path), key;
+	parent.segs.pop_back();
+	key.valid = true;
+	key.segs.push_back(path.segs.back());
+
+	UniValue doc;
+	JsonSpot spot;
+	bool ok = true;
+
+	if (!added.empty()) {
+		string text;
+		if (tape.check(root)) {
+			FdWriter out(text);
+			tape.write(out, root, 0, added);
+		}
+		ok = !text.empty() && doc.read(text);
+		key = path;
+	} else if (!tape.findSpot(root, parent, spot)) {
+		ok = false;
+	} else if (spot.matched && (spot.type == '[' || spot.type == '{')) {
+		ok = tape.materialize(spot.start, doc);
+	}
+
+	if (!ok) {
+		fprintf(stderr, "(stdin): Invalid JSON input\n");
+		return false;
+	}
+
+	objIndex.clear();
+	jdocTake(doc, key);
+	objIndex.clear();
+	moveValue(jdoc, doc);
+	return true;
+}
+
+// --lazy: run the program against a structural index of stdin rather
+// than a parsed tree.  Paths are resolved on the index, additions are
+// held per container, and "get" re-roots the document.  Only once a
+// command needs a real value (a scalar, or a replacement document)
+// is anything parsed, and the rest of the program runs on that.
+static bool processLazy()
+{
+	MappedInput in;
+
+	StatsTimer readTime(jupStats, "read");
+	if (!in.openFd(STDIN_FILENO, "(stdin)"))
+		return false;
+	readTime.bytes(in.size(), 0);
+	readTime.stop();
+
+	// a top-level scalar has nothing to skip
+	const char *p = in.data();
+	const char *end = p + in.size();
+	while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' ||
+			   *p == '\r'))
+		p++;
+	if (p == end || (*p != '{' && *p != '[')) {
+		StatsTimer parseTime(jupStats, "parse");
+		parseTime.bytes(in.size(), 0);
+		if (!jdoc.read(in.data(), in.size())) {
+			fprintf(stderr, "(stdin): Invalid JSON input\n");
+			return false;
+		}
+		parseTime.stop();
+		return processDocument(jdoc) && writeOutput();
+	}
+
+	StatsTimer indexTime(jupStats, "index");
+	indexTime.bytes(in.size(), 0);
+	JsonTape tape;
+	if (!is_valid_utf8(in.data(), in.size()) ||
+	    !tape.build(in.data(), in.size())) {
+		fprintf(stderr, "(stdin): Invalid JSON input\n");
+		return false;
+	}
+	indexTime.stop();
+
+	// the build checked structure only; check the whole input, not
+	// just what a get selects, before anything is written
+	StatsTimer checkTime(jupStats, "check");
+	if (!tape.check(tape.root())) {
+		fprintf(stderr, "(stdin): Invalid JSON input\n");
+		return false;
+	}
+	checkTime.stop();
+
+	size_t root = tape.root();
+	tapeAdditions added;
+	objIndex.clear();
+
+	for (size_t i = 0; i < program.size(); i++) {
+		const editOp& op = program[i];
+		JsonSpot spot;
+		UniValue *slot;
+
+		if (op.cmd->id == CMD_NEW || op.cmd->id == CMD_NEWARRAY)
+			return processDocument(jdoc, i) && writeOutput();
+
+		StatsTimer t(jupStats, "command");
+		timeCommand(t, op);
+
+		if (isMultiGet(op.cmd->id)) {
+			if (!lazyMultiGet(tape, root, added, op))
+				return false;
+			t.stop();
+			return processDocument(jdoc, i + 1) && writeOutput();
+		}
+
+		if (op.cmd->id == CMD_GET && op.path.valid &&
+		    op.path.sliced()) {
+			if (!lazySlice(tape, root, added, op.path))
+				return false;
+			t.stop();
+			return processDocument(jdoc, i + 1) && writeOutput();
+		}
+
+		if (!tape.findSpot(root, op.path, spot)) {
+			fprintf(stderr, "(stdin): Invalid JSON input\n");
+			return false;
+		}
+
+		switch (op.cmd->id) {
+		case CMD_GET: {
+			bool isContainer = (spot.type == '{' ||
+					    spot.type == '[');
+
+			if (!op.path.valid || op.path.empty()) {
+				jdoc.setNull();
+			} else if (spot.matched && isContainer) {
+				root = spot.start;
+				continue;
+			} else if (spot.matched) {
+				if (!tape.materialize(spot.start, jdoc)) {
+					fprintf(stderr, "(stdin): Invalid JSON input\n");
+					return false;
+				}
+			} else if (isContainer && added.count(spot.start)) {
+				JsonPath rest;
+				additionPath(op.path, spot, rest);
+				jdoc = jdocGet(added[spot.start], rest);
+			} else {
+				jdoc.setNull();
+			}
+
+			t.stop();
+			return processDocument(jdoc, i + 1) && writeOutput();
+		}
+
+		case CMD_FILE_TEXT:
+		case CMD_FILE_JSON:
+		case CMD_FILE_HEX:
+		case CMD_FILE_BASE64:
+		case CMD_FILE_CSV: {
+			UniValue jval;
+
+			if (!readFileValue(op, jval) ||
+			    !(slot = spotInsert(spot, added, op.path)))
+				return false;
+			moveValue(*slot, jval);
+			break;
+		}
+
+		default:
+			if (!(slot = spotInsert(spot, added, op.path)))
+				return false;
+			*slot = op.value;
+			break;
+		}
+	}
+
+	FdWriter out(STDOUT_FILENO);
+	return writeTimed(out, [&] {
+		tape.write(out, root, minimalJson ? 0 : defaultIndent, added);
+		out.push('\n');
+		return out.flush();
+	});
+}
+
+static bool isBlankLine(const char *line, size_t len)
+{
+	for (size_t i = 0; i < len; i++)
+		if (!isspace(line[i]))
+			return false;
+
+	return true;
+}
+
+// parse one record and run the command sequence over it
+static bool processRecord(UniValue& doc, const char *line, size_t lineLen,
+			  unsigned long lineNo)
+{
+	if (!doc.read(line, lineLen)) {
+		fprintf(stderr, "(stdin):%lu: Invalid JSON input\n", lineNo);
+		return false;
+	}
+
+	if (!processDocument(doc)) {
+		fprintf(stderr, "(stdin):%lu: processing failed\n", lineNo);
+		return false;
+	}
+
+	return true;
+}
+
+static bool processLines()
+{
+	LineReader lr(STDIN_FILENO);
+	FdWriter out(STDOUT_FILENO);
+	const char *line;
+	size_t lineLen;
+	unsigned long lineNo = 0;
+	bool ok = true;
+
+	while (ok && lr.getline(line, lineLen)) {
+		lineNo++;
+		if (isBlankLine(line, lineLen))
+			continue;
+
+		if (!processRecord(jdoc, line, lineLen, lineNo)) {
+			out.flush();
+			ok = false;
+			break;
+		}
+
+		writeJson(out, jdoc, 0);
+		out.push('\n');
+
+		// never sit on output while waiting for more input
+		if (!lr.lineBuffered() && !out.flush())
+			ok = false;
+	}
+
+	if (ok && !out.flush())
+		ok = false;
+
+	jupStats.count(lr.bytesRead(), out.bytesWritten());
+	return ok && !lr.haveError();
+}
+
+static const size_t BATCH_RECORDS = 512;
+static const size_t BATCH_BYTES = 1 << 20;
+
+class lineBatch {
+public:
+	vector<string> records;
+	vector<unsigned long> lineNos;
+	string output;
+	bool failed;
+	bool done;
+
+	lineBatch() : failed(false), done(false) {}
+};
+
+static void runLineBatch(lineBatch& batch)
+{
+	UniValue doc;		// per-thread document
+
+	for (size_t i = 0; i < batch.records.size(); i++) {
+		const string& rec = batch.records[i];
+		if (!processRecord(doc, rec.data(), rec.size(),
+				   batch.lineNos[i])) {
+			batch.failed = true;
+			break;
+		}
+
+		writeJson(batch.output, doc, 0);
+		batch.output.push_back('\n');
+	}
+}
+
+// Reader (this thread) splits input into batches, a worker pool runs
+// the command sequence on each, and batches are written in input order.
+static bool processLinesParallel()
+{
+	mutex doneLock;
+	condition_variable doneCond;
+	atomic<bool> abortJobs(false);
+	ThreadPool pool(nThreads);
+
+	LineReader lr(STDIN_FILENO);
+	deque<shared_ptr<lineBatch>> window;
+	const size_t maxWindow = nThreads * 4;
+	unsigned long lineNo = 0;
+	uint64_t bytesOut = 0;
+	bool inputDone = false;
+	bool ok = true;
+
+	while (ok) {
+		// read ahead, keeping a bounded number of batches in flight
+		while (!inputDone && window.size() < maxWindow) {
+			shared_ptr<lineBatch> batch = make_shared<lineBatch>();
+			size_t bytes = 0;
+			const char *line;
+			size_t lineLen;
+
+			while (batch->records.size() < BATCH_RECORDS &&
+			       bytes < BATCH_BYTES) {
+				if (!lr.getline(line, lineLen)) {
+					inputDone = true;
+					break;
+				}
+				lineNo++;
+				if (isBlankLine(line, lineLen))
+					continue;
+
+				batch->records.emplace_back(line, lineLen);
+				batch->lineNos.push_back(lineNo);
+				bytes += lineLen;
+			}
+
+			if (batch->records.empty())
+				break;
+
+			window.push_back(batch);
+			pool.push([batch, &doneLock, &doneCond, &abortJobs] {
+				if (!abortJobs)
+					runLineBatch(*batch);
+				{
+					lock_guard<mutex> lk(doneLock);
+					batch->done = true;
+				}
+				doneCond.notify_all();
+			});
+		}
+
+		if (window.empty())
+			break;
+
+		// ordered writer: emit oldest batch once it completes
+		shared_ptr<lineBatch> front = window.front();
+		window.pop_front();
+		{
+			unique_lock<mutex> lk(doneLock);
+			doneCond.wait(lk, [&front] { return front->done; });
+		}
+
+		if (!writeStringFd(STDOUT_FILENO, front->output) ||
+		    front->failed)
+			ok = false;
+		else
+			bytesOut += front->output.size();
+	}
+
+	// skip work still queued after a failure; pool joins on return
+	abortJobs = true;
+
+	jupStats.count(lr.bytesRead(), bytesOut);
+	return ok && !lr.haveError();
+}
+
+static bool ignoreStdin()
+{
+	return program.size() > 0 && program[0].cmd->ignoreStdin;
+}
+
+// Collect batch input paths from a directory (its regular files, in
+// name order) or from a list file of one path per line.
+static bool readBatchList(const string& list, vector<string>& paths)
+{
+	struct stat st;
+	if (list != "-" && stat(list.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+		DIR *dir = opendir(list.c_str());
+		if (!dir) {
+			perror(list.c_str());
+			return false;
+		}
+
+		struct dirent *de;
+		while ((de = readdir(dir)) != nullptr) {
+			if (de->d_name[0] == '.')
+				continue;
+
+			string path = list + "/" + de->d_name;
+			if (stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode))
+				paths.push_back(path);
+		}
+		closedir(dir);
+
+		sort(paths.begin(), paths.end());
+		return true;
+	}
+
+	int fd = STDIN_FILENO;
+	if (list != "-") {
+		fd = open(list.c_str(), O_RDONLY);
+		if (fd < 0) {
+			perror(list.c_str());
+			return false;
+		}
+	}
+
+	LineReader lr(fd);
+	const char *line;
+	size_t lineLen;
+	while (lr.getline(line, lineLen)) {
+		if (lineLen > 0 && line[lineLen - 1] == '\r')
+			lineLen--;
+		if (!isBlankLine(line, lineLen))
+			paths.emplace_back(line, lineLen);
+	}
+
+	if (fd != STDIN_FILENO)
+		close(fd);
+
+	if (lr.haveError()) {
+		perror(list.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+static string baseName(const string& path)
+{
+	size_t slash = path.rfind('/');
+	return (slash == string::npos) ? path : path.substr(slash + 1);
+}
+
+class batchJob {
+public:
+	string path;
+	string output;		// stdout mode: rendered result
+	uint64_t bytesIn;
+	uint64_t bytesOut;
+	bool ok;
+	bool done;
+
+	batchJob(const string& path_) : path(path_), bytesIn(0), bytesOut(0),
+		ok(false), done(false) {}
+};
+
+static bool runBatchFile(batchJob& job)
+{
+	UniValue doc;
+
+	if (!ignoreStdin()) {
+		MappedInput in;
+		if (!in.open(job.path))
+			return false;
+		job.bytesIn = in.size();
+		if (!doc.read(in.data(), in.size())) {
+			fprintf(stderr, "%s: Invalid JSON input\n",
+				job.path.c_str());
+			return false;
+		}
+	}
+
+	if (!processDocument(doc))
+		return false;
+
+	if (outputDir.empty()) {
+		FdWriter out(job.output);
+		return writeDocument(out, doc);
+	}
+
+	string outPath = outputDir + "/" + baseName(job.path);
+	int fd = open(outPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (fd < 0) {
+		perror(outPath.c_str());
+		return false;
+	}
+
+	bool ok;
+	{
+		FdWriter out(fd);
+		ok = writeDocument(out, doc);
+		job.bytesOut = out.bytesWritten();
+	}
+
+	if (close(fd) < 0) {
+		perror(outPath.c_str());
+		ok = false;
+	}
+
+	return ok;
+}
+
+// Run the compiled program over every batch input on a worker pool.
+// Results are reported (and, without --output-dir, written to stdout
+// behind a "==> path <==" header) in input order.
+static bool processBatch()
+{
+	vector<string> paths;
+	if (!readBatchList(batchList, paths))
+		return false;
+
+	if (!outputDir.empty()) {
+		// one output per input name; never silently overwrite
+		unordered_set<string> names;
+		for (const string& path : paths) {
+			if (!names.insert(baseName(path)).second) {
+				fprintf(stderr, "%s: duplicate output name in batch\n",
+					path.c_str());
+				return false;
+			}
+		}
+	}
+
+	mutex doneLock;
+	condition_variable doneCond;
+	ThreadPool pool(nThreads);
+	deque<shared_ptr<batchJob>> window;
+	const size_t maxWindow = nThreads * 4;
+	size_t nextPath = 0;
+	unsigned long nFailed = 0;
+	bool writeOk = true;
+
+	while (true) {
+		while (nextPath < paths.size() && window.size() < maxWindow) {
+			shared_ptr<batchJob> job =
+				make_shared<batchJob>(paths[nextPath++]);
+
+			window.push_back(job);
+			pool.push([job, &doneLock, &doneCond] {
+				bool ok = runBatchFile(*job);
+				{
+					lock_guard<mutex> lk(doneLock);
+					job->ok = ok;
+					job->done = true;
+				}
+				doneCond.notify_all();
+			});
+		}
+
+		if (window.empty())
+			break;
+
+		shared_ptr<batchJob> front = window.front();
+		window.pop_front();
+		{
+			unique_lock<mutex> lk(doneLock);
+			doneCond.wait(lk, [&front] { return front->done; });
+		}
+
+		if (front->ok && outputDir.empty() && writeOk) {
+			string header = "==> " + front->path + " <==\n";
+			if (!front->output.empty() &&
+			    front->output[front->output.size() - 1] != '\n')
+				front->output.push_back('\n');
+			writeOk = writeStringFd(STDOUT_FILENO, header) &&
+				  writeStringFd(STDOUT_FILENO, front->output);
+			if (writeOk)
+				front->bytesOut = header.size() +
+						  front->output.size();
+		}
+		jupStats.count(front->bytesIn, front->bytesOut);
+
+		fprintf(stderr, "%s: %s\n", front->path.c_str(),
+			front->ok ? "ok" : "FAILED");
+		if (!front->ok)
+			nFailed++;
+	}
+
+	return writeOk && nFailed == 0;
+}
+
+// spotInsert() into inPlaceFile, noting where each edited container is
+static UniValue *inPlaceInsert(JsonScanner& scan, tapeAdditions& added,
+			       map<size_t, JsonSpot>& spots,
+			       const JsonPath& path)
+{
+	JsonSpot spot;
+
+	if (!scan.findSpot(path, spot)) {
+		fprintf(stderr, "%s: Invalid JSON input\n",
+			inPlaceFile.c_str());
+		return nullptr;
+	}
+
+	UniValue *slot = spotInsert(spot, added, path);
+	if (slot)
+		spots.insert(make_pair(spot.start, spot));
+
+	return slot;
+}
+
+// New members, laid out after the container's existing ones
+static void inPlaceText(const JsonSpot& spot, const UniValue& extra,
+			string& text)
+{
+	const vector<UniValue>& values = extra.getValues();
+	bool pretty = (spot.lead.find('\n') != string::npos);
+
+	for (size_t i = 0; i < values.size(); i++) {
+		if (i > 0 || !spot.empty)
+			text.push_back(',');
+		text.append(spot.lead);
+
+		if (extra.isObject()) {
+			writeJson(text, UniValue(extra.getKeys()[i]), 0);
+			text.append(pretty ? ": " : ":");
+		}
+		writeJson(text, values[i], 0);
+	}
+}
+
+// Run the program against inPlaceFile.  No document is built: each
+// path is found by a structural scan, and only the new members are
+// written, spliced between verbatim copies of the rest of the file.
+static bool processInPlace()
+{
+	int fd = open(inPlaceFile.c_str(), O_RDONLY);
+	if (fd < 0) {
+		perror(inPlaceFile.c_str());
+		return false;
+	}
+
+	struct stat st;
+	JsonScanner scan;
+	bool opened = (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) &&
+		       scan.openFd(fd, inPlaceFile));
+	close(fd);		// mapping outlives the descriptor
+	if (!opened) {
+		fprintf(stderr, "%s: not a regular file\n",
+			inPlaceFile.c_str());
+		return false;
+	}
+	jupStats.count(st.st_size, 0);
+
+	tapeAdditions added;
+	map<size_t, JsonSpot> spots;
+	objIndex.clear();
+
+	for (const editOp& op : program) {
+		UniValue *slot;
+
+		switch (op.cmd->id) {
+		case CMD_GET:
+		case CMD_GET_ARRAY:
+		case CMD_GET_OBJECT:
+		case CMD_NEW:
+		case CMD_NEWARRAY:
+			fprintf(stderr, "%s: not supported with --in-place\n",
+				op.cmd->name);
+			return false;
+
+		case CMD_FILE_TEXT:
+		case CMD_FILE_JSON:
+		case CMD_FILE_HEX:
+		case CMD_FILE_BASE64:
+		case CMD_FILE_CSV: {
+			UniValue jval;
+
+			if (!readFileValue(op, jval) ||
+			    !(slot = inPlaceInsert(scan, added, spots,
+						   op.path)))
+				return false;
+			moveValue(*slot, jval);
+			break;
+		}
+
+		default:
+			if (!(slot = inPlaceInsert(scan, added, spots, op.path)))
+				return false;
+			*slot = op.value;
+			break;
+		}
+	}
+
+	if (added.empty())
+		return true;
+
+	vector<FileSplice> splices;
+	for (const auto& it : added) {
+		const JsonSpot& spot = spots[it.first];
+		FileSplice sp;
+		sp.offset = spot.insertAt;
+		sp.len = 0;
+		inPlaceText(spot, it.second, sp.text);
+		splices.push_back(sp);
+	}
+
+	// additions are keyed by container start; nested containers end
+	// (and so take their new members) before their parents
+	sort(splices.begin(), splices.end(),
+	     [](const FileSplice& a, const FileSplice& b) {
+		return a.offset < b.offset;
+	});
+
+	if (!spliceFile(inPlaceFile, splices))
+		return false;
+
+	uint64_t bytesOut = st.st_size;
+	for (const FileSplice& sp : splices)
+		bytesOut += sp.text.size() - sp.len;
+	jupStats.count(0, bytesOut);
+	return true;
+}
+
+// Option defaults, restored before each run so each server request
+// starts clean
+static void resetOptions()
+{
+	minimalJson = false;
+	doListCommands = false;
+	doListUsages = false;
+	optDecodeMode = DecNone;
+	defaultIndent = 2;
+	linesMode = false;
+	nThreads = 1;
+	threadsGiven = false;
+	csvHeader = false;
+	csvTypes = false;
+	batchList.clear();
+	outputDir.clear();
+	serveSocket.clear();
+	useArena = false;
+	noFree = false;
+	inPlaceFile.clear();
+	lazyMode = false;
+	statsWanted = false;
+	statsFile.clear();
+	jupStats.reset(false);
+	memProfile = false;
+	memProfileTop = 10;
+	stopEarly = false;
+	inputTokens.clear();
 }
 
 static void envInit()
@@ -719,9 +2325,36 @@ static void envInit()
 	}
 }
 
-int main (int argc, char *argv[])
+// --stats, --mem-profile: a report, as one line of JSON on stderr or
+// in filename
+static void writeReport(const string& filename, const UniValue& report)
+{
+	int fd = STDERR_FILENO;
+	if (!filename.empty()) {
+		fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC,
+			  0666);
+		if (fd < 0) {
+			perror(filename.c_str());
+			return;
+		}
+	}
+
+	{
+		FdWriter out(fd);
+		writeJson(out, report, 0);
+		out.push('\n');
+		out.flush();
+	}
+
+	if (fd != STDERR_FILENO)
+		close(fd);
+}
+
+static int serveOne(int argc, char *argv[]);
+
+static int jupRun(int argc, char *argv[])
 {
-	staticInit();
+	resetOptions();
 	envInit();
 
 	// parse command line
@@ -732,16 +2365,137 @@ int main (int argc, char *argv[])
 		return EXIT_FAILURE;
 	}
 
+	jupStats.reset(statsWanted);
+	if (memProfile)
+		allocProfileStart();
+
 	if (doListCommands || doListUsages) {
 		listCommands(doListCommands ? true : false);
 		return EXIT_SUCCESS;
 	}
 
+	if (!serveSocket.empty()) {
+		if (!inputTokens.empty()) {
+			fprintf(stderr, "--serve does not take edit commands\n");
+			return EXIT_FAILURE;
+		}
+
+		unsigned int workers = threadsGiven ? nThreads :
+					defaultThreadCount();
+		serveRequests(serveSocket, workers, serveOne);
+		return EXIT_FAILURE;
+	}
+
+	if (!compileProgram())
+		return EXIT_FAILURE;
+
+	// per-phase timing covers the single-document paths
+	if (!inPlaceFile.empty() || !batchList.empty() || linesMode)
+		jupStats.totalsOnly();
+
+	if (!inPlaceFile.empty()) {
+		if (linesMode || !batchList.empty()) {
+			fprintf(stderr, "--in-place cannot be combined with --lines or --batch\n");
+			return EXIT_FAILURE;
+		}
+
+		return processInPlace() ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	if (!batchList.empty()) {
+		if (linesMode) {
+			fprintf(stderr, "--batch cannot be combined with --lines\n");
+			return EXIT_FAILURE;
+		}
+
+		return processBatch() ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	if (linesMode) {
+		if (optDecodeMode != DecNone) {
+			fprintf(stderr, "--lines cannot be combined with --unhex or --un64\n");
+			return EXIT_FAILURE;
+		}
+
+		bool rc = (nThreads > 1) ? processLinesParallel() :
+					   processLines();
+		return rc ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	JsonPath getPath;
+	const editOp *multiGet;
+	if (streamGetPath(getPath, multiGet)) {
+		if (!(multiGet ? readInputMultiGet(getPath, *multiGet) :
+				 readInputGet(getPath)) ||
+		    !writeOutput())
+			return EXIT_FAILURE;
+
+		return EXIT_SUCCESS;
+	}
+
+	if (lazyMode && !ignoreStdin())
+		return processLazy() ? EXIT_SUCCESS : EXIT_FAILURE;
+
+	if (useArena)
+		arenaInit();
+
 	if ((!ignoreStdin() && !readInput()) ||
-	    !processDocument() ||
+	    !processDocument(jdoc) ||
 	    !writeOutput())
 		return EXIT_FAILURE;
 
 	return EXIT_SUCCESS;
 }
 
+static int jupMain(int argc, char *argv[])
+{
+	int status = jupRun(argc, argv);
+
+	if (jupStats.on())
+		writeReport(statsFile, jupStats.report(status));
+	if (memProfile)
+		writeReport("", memProfileReport(jdoc, memProfileTop));
+
+	return status;
+}
+
+static void freeDocument()
+{
+	// abandon the arena-built document rather than destroying it
+	// node by node; its memory is unmapped in one step
+	if (useArena) {
+		new (&jdoc) UniValue(UniValue::VNULL);
+		arenaRelease();
+	} else
+		jdoc.setNull();
+}
+
+// One --serve request, run in a server worker
+static int serveOne(int argc, char *argv[])
+{
+	int status = jupMain(argc, argv);
+
+	// a worker runs for the server's lifetime, so nothing a request
+	// compiled may accumulate, interned path keys included
+	freeDocument();
+	objIndex.clear();
+	program.clear();
+	internClear();
+	return status;
+}
+
+int main (int argc, char *argv[])
+{
+	int status = jupMain(argc, argv);
+
+	// leave the document, and everything else, to process teardown
+	if (noFree) {
+		fflush(NULL);
+		_exit(status);
+	}
+
+	if (useArena)
+		freeDocument();
+
+	return status;
+}
@@ -0,0 +1,206 @@
+
+#include "jup-config.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "serveproto.h"
+
+/*
+ * jupc: hand a jup invocation to the "jup --serve" server named by
+ * JUP_SERVER, and exit with its status.  Only libc is linked, so this
+ * starts far faster than jup itself.  With no server, jup is run.
+ */
+
+#ifndef JUP_BINARY
+#define JUP_BINARY "jup"
+#endif
+
+extern char **environ;
+
+static int readFull(int fd, void *buf_, size_t len)
+{
+	char *buf = buf_;
+	while (len > 0) {
+		ssize_t rrc = read(fd, buf, len);
+		if (rrc < 0 && errno == EINTR)
+			continue;
+		if (rrc <= 0)
+			return 0;
+		buf += rrc;
+		len -= rrc;
+	}
+	return 1;
+}
+
+static int sendFull(int fd, const void *buf_, size_t len)
+{
+	const char *buf = buf_;
+	while (len > 0) {
+		ssize_t wrc = send(fd, buf, len, MSG_NOSIGNAL);
+		if (wrc < 0 && errno == EINTR)
+			continue;
+		if (wrc <= 0)
+			return 0;
+		buf += wrc;
+		len -= wrc;
+	}
+	return 1;
+}
+
+struct payload {
+	char	*data;
+	size_t	len;
+	size_t	alloc;
+};
+
+/* append s, NUL included */
+static int addStr(struct payload *pl, const char *s)
+{
+	size_t n = strlen(s) + 1;
+	if (pl->len + n > pl->alloc) {
+		size_t alloc = pl->alloc ? pl->alloc * 2 : 4096;
+		while (alloc < pl->len + n)
+			alloc *= 2;
+		char *data = realloc(pl->data, alloc);
+		if (!data)
+			return 0;
+		pl->data = data;
+		pl->alloc = alloc;
+	}
+	memcpy(pl->data + pl->len, s, n);
+	pl->len += n;
+	return 1;
+}
+
+static int buildPayload(struct payload *pl, int argc, char *argv[])
+{
+	char cwd[4096];
+	char count[32];
+	unsigned long nEnv = 0;
+	char **e;
+	int i;
+
+	if (!getcwd(cwd, sizeof(cwd)) || !addStr(pl, cwd))
+		return 0;
+
+	for (e = environ; *e; e++)
+		if (!strncmp(*e, "JUP_", 4) && strncmp(*e, "JUP_SERVER=", 11))
+			nEnv++;
+	snprintf(count, sizeof(count), "%lu", nEnv);
+	if (!addStr(pl, count))
+		return 0;
+	for (e = environ; *e; e++)
+		if (!strncmp(*e, "JUP_", 4) && strncmp(*e, "JUP_SERVER=", 11) &&
+		    !addStr(pl, *e))
+			return 0;
+
+	/* the server's messages name jup, not jupc */
+	if (!addStr(pl, "jup"))
+		return 0;
+	for (i = 1; i < argc; i++)
+		if (!addStr(pl, argv[i]))
+			return 0;
+
+	return pl->len <= JUP_MAX_PAYLOAD;
+}
+
+/*
+ * Send this invocation (argv plus fds 0-2) to the server at sockPath
+ * and wait for its exit status.  Returns 0, with nothing consumed, if
+ * no server answers.
+ */
+static int forwardToServer(const char *sockPath, int argc, char *argv[],
+			   int *exitStatus)
+{
+	struct sockaddr_un addr;
+	struct payload pl = { NULL, 0, 0 };
+	struct jupReqHeader hdr;
+	int fds[3] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+	char cbuf[CMSG_SPACE(sizeof(fds))];
+	struct iovec iov = { &hdr, sizeof(hdr) };
+	struct msghdr msg;
+	struct cmsghdr *cm;
+	ssize_t wrc;
+	int32_t status;
+	int fd, ok;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(sockPath) >= sizeof(addr.sun_path))
+		return 0;
+	strcpy(addr.sun_path, sockPath);
+
+	if (!buildPayload(&pl, argc, argv)) {
+		free(pl.data);
+		return 0;
+	}
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0 ||
+	    connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+		if (fd >= 0)
+			close(fd);
+		free(pl.data);
+		return 0;
+	}
+
+	hdr.magic = JUP_REQ_MAGIC;
+	hdr.argc = argc;
+	hdr.len = pl.len;
+
+	memset(cbuf, 0, sizeof(cbuf));
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cbuf;
+	msg.msg_controllen = sizeof(cbuf);
+
+	cm = CMSG_FIRSTHDR(&msg);
+	cm->cmsg_level = SOL_SOCKET;
+	cm->cmsg_type = SCM_RIGHTS;
+	cm->cmsg_len = CMSG_LEN(sizeof(fds));
+	memcpy(CMSG_DATA(cm), fds, sizeof(fds));
+
+	do {
+		wrc = sendmsg(fd, &msg, MSG_NOSIGNAL);
+	} while (wrc < 0 && errno == EINTR);
+
+	ok = (wrc == (ssize_t) sizeof(hdr)) &&
+	     sendFull(fd, pl.data, pl.len) &&
+	     readFull(fd, &status, sizeof(status));
+	close(fd);
+	free(pl.data);
+
+	/*
+	 * once the request is sent the server owns our stdio, so a lost
+	 * reply is a failure, not a reason to run jup here
+	 */
+	if (wrc != (ssize_t) sizeof(hdr))
+		return 0;
+
+	if (!ok)
+		fprintf(stderr, "jupc: %s: request lost\n", sockPath);
+	*exitStatus = ok ? status : EXIT_FAILURE;
+	return 1;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *server = getenv("JUP_SERVER");
+	int status;
+
+	if (argc < 1)
+		return EXIT_FAILURE;
+	if (server && *server && forwardToServer(server, argc, argv, &status))
+		return status;
+
+	argv[0] = (char *) JUP_BINARY;
+	execvp(JUP_BINARY, argv);
+	fprintf(stderr, "jupc: %s: %s\n", JUP_BINARY, strerror(errno));
+	return 127;
+}
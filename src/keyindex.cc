@@ -0,0 +1,123 @@
+
+#include "jup-config.h"
+#include <algorithm>
+#include <functional>
+#include "keyindex.h"
+
+using namespace std;
+
+static size_t hashKey(const string& key)
+{
+	return hash<string>()(key);
+}
+
+void KeyIndex::insert(const vector<string>& keys, size_t slot)
+{
+	size_t mask = table.size() - 1;
+	size_t h = hashKey(keys[slot]) & mask;
+
+	while (table[h]) {
+		// keep the first of duplicate keys
+		if (keys[table[h] - 1] == keys[slot])
+			return;
+		h = (h + 1) & mask;
+	}
+
+	table[h] = slot + 1;
+}
+
+void KeyIndex::build(const UniValue& obj)
+{
+	const vector<string>& keys = obj.getKeys();
+
+	// load factor <= 1/2
+	size_t tableSize = 16;
+	while (tableSize < keys.size() * 2)
+		tableSize *= 2;
+
+	table.assign(tableSize, 0);
+	for (size_t i = 0; i < keys.size(); i++)
+		insert(keys, i);
+
+	keysData = keys.data();
+	nKeys = keys.size();
+}
+
+void KeyIndex::appended(const UniValue& obj)
+{
+	const vector<string>& keys = obj.getKeys();
+
+	if (keys.size() != nKeys + 1 || keys.size() * 2 > table.size()) {
+		build(obj);
+		return;
+	}
+
+	insert(keys, nKeys);
+	keysData = keys.data();
+	nKeys = keys.size();
+}
+
+bool KeyIndex::find(const UniValue& obj, const string& key,
+		    size_t& slot) const
+{
+	const vector<string>& keys = obj.getKeys();
+	size_t mask = table.size() - 1;
+	size_t h = hashKey(key) & mask;
+
+	while (table[h]) {
+		if (keys[table[h] - 1] == key) {
+			slot = table[h] - 1;
+			return true;
+		}
+		h = (h + 1) & mask;
+	}
+
+	return false;
+}
+
+bool KeyIndexCache::findKey(const UniValue& obj, const string& key,
+			    size_t& slot,
+			    const vector<const UniValue *>& ancestors)
+{
+	const vector<string>& keys = obj.getKeys();
+
+	if (keys.size() < THRESHOLD) {
+		for (size_t i = 0; i < keys.size(); i++) {
+			if (keys[i] == key) {
+				slot = i;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	KeyIndex& idx = indexes[&obj];
+	if (!idx.current(obj)) {
+		idx.build(obj);
+		idx.ancestors = ancestors;
+	}
+
+	return idx.find(obj, key, slot);
+}
+
+void KeyIndexCache::noteAppend(const UniValue& obj, bool moved)
+{
+	// children were copied to new storage; any index of a descendant
+	// is keyed by a stale address
+	if (moved) {
+		unordered_map<const UniValue *, KeyIndex>::iterator it;
+		for (it = indexes.begin(); it != indexes.end(); ) {
+			const vector<const UniValue *>& anc =
+				it->second.ancestors;
+			if (find(anc.begin(), anc.end(), &obj) != anc.end())
+				it = indexes.erase(it);
+			else
+				++it;
+		}
+	}
+
+	unordered_map<const UniValue *, KeyIndex>::iterator it =
+		indexes.find(&obj);
+	if (it != indexes.end())
+		it->second.appended(obj);
+}
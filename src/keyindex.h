@@ -0,0 +1,66 @@
+#ifndef __KEYINDEX_H__
+#define __KEYINDEX_H__
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "univalue/include/univalue.h"
+
+// Flat open-addressing hash from key to slot in an object's parallel
+// getKeys()/getValues() vectors.  UniValue's own key lookup is a linear
+// scan; this side index makes lookups in wide objects O(1) while the
+// object itself, and therefore output key order, is unchanged.
+class KeyIndex {
+private:
+	std::vector<uint32_t>	table;		// slot+1; 0 = empty
+	const std::string	*keysData;	// identity of indexed keys
+	size_t			nKeys;
+
+public:
+	// containers from the document root down to (not including) the
+	// indexed object.  Reallocating any of them moves the object.
+	std::vector<const UniValue *>	ancestors;
+
+private:
+
+	void insert(const std::vector<std::string>& keys, size_t slot);
+
+public:
+	KeyIndex() : keysData(nullptr), nKeys(0) {}
+
+	bool current(const UniValue& obj) const {
+		const std::vector<std::string>& keys = obj.getKeys();
+		return keysData == keys.data() && nKeys == keys.size();
+	}
+
+	void build(const UniValue& obj);
+	void appended(const UniValue& obj);
+	bool find(const UniValue& obj, const std::string& key,
+		  size_t& slot) const;
+};
+
+// Lazily built KeyIndexes for the wide objects of one document.
+class KeyIndexCache {
+private:
+	std::unordered_map<const UniValue *, KeyIndex>	indexes;
+
+public:
+	// objects below this many keys are scanned linearly
+	static const size_t THRESHOLD = 32;
+
+	// First slot holding key, as UniValue::operator[] would find.
+	// ancestors: path of containers from the root down to obj.
+	bool findKey(const UniValue& obj, const std::string& key,
+		     size_t& slot,
+		     const std::vector<const UniValue *>& ancestors);
+
+	// obj gained one child at the end.  If its values were
+	// reallocated (moved), indexes of its descendants are dropped.
+	void noteAppend(const UniValue& obj, bool moved);
+
+	// the document was replaced or rebuilt
+	void clear() { indexes.clear(); }
+};
+
+#endif // __KEYINDEX_H__
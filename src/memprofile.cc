@@ -0,0 +1,159 @@
+
+#include "jup-config.h"
+#include <stdio.h>
+#include <sys/resource.h>
+#include <algorithm>
+#include <queue>
+#include "arena.h"
+#include "memprofile.h"
+
+using namespace std;
+
+// heap behind s; short strings are held inside the object
+static size_t stringHeap(const string& s)
+{
+	const char *obj = (const char *) &s;
+	if (s.data() >= obj && s.data() < obj + sizeof(s))
+		return 0;
+	return s.capacity() + 1;
+}
+
+static bool heavierThan(const SubtreeCost& a, const SubtreeCost& b)
+{
+	return a.bytes > b.bytes;
+}
+
+class subtreeWalk {
+public:
+	size_t			topN;
+	vector<string>		segs;		// path to the current node
+	// lightest of the current top N at the front
+	priority_queue<SubtreeCost, vector<SubtreeCost>,
+		       decltype(&heavierThan)> top;
+
+	explicit subtreeWalk(size_t topN_)
+		: topN(topN_), top(&heavierThan) {}
+
+	void offer(size_t bytes, size_t nodes);
+};
+
+void subtreeWalk::offer(size_t bytes, size_t nodes)
+{
+	if (topN == 0 || (top.size() == topN && bytes <= top.top().bytes))
+		return;
+
+	SubtreeCost sc;
+	for (size_t i = 0; i < segs.size(); i++) {
+		if (i)
+			sc.path += '.';
+		sc.path += segs[i];
+	}
+	sc.bytes = bytes;
+	sc.nodes = nodes;
+
+	top.push(sc);
+	if (top.size() > topN)
+		top.pop();
+}
+
+// Heap held by val's strings and child vectors, not counting val's
+// own UniValue
+static size_t walkValue(subtreeWalk& w, const UniValue& val, size_t& nodes)
+{
+	size_t bytes = stringHeap(val.getValStr());
+	nodes = 1;
+
+	if (!val.isObject() && !val.isArray())
+		return bytes;
+
+	const vector<UniValue>& values = val.getValues();
+	bytes += (values.capacity() - values.size()) * sizeof(UniValue);
+
+	const vector<string> *keys = nullptr;
+	if (val.isObject()) {
+		keys = &val.getKeys();
+		bytes += (keys->capacity() - keys->size()) * sizeof(string);
+	}
+
+	char idx[32];
+	for (size_t i = 0; i < values.size(); i++) {
+		size_t cost = sizeof(UniValue);
+		if (keys) {
+			const string& key = (*keys)[i];
+			cost += sizeof(string) + stringHeap(key);
+			w.segs.push_back(key);
+		} else {
+			snprintf(idx, sizeof(idx), "%zu", i);
+			w.segs.push_back(idx);
+		}
+
+		size_t childNodes;
+		cost += walkValue(w, values[i], childNodes);
+		w.offer(cost, childNodes);
+		w.segs.pop_back();
+
+		bytes += cost;
+		nodes += childNodes;
+	}
+
+	return bytes;
+}
+
+size_t heaviestSubtrees(const UniValue& doc, size_t topN,
+			vector<SubtreeCost>& top)
+{
+	subtreeWalk w(topN);
+	size_t nodes;
+	size_t total = sizeof(UniValue) + walkValue(w, doc, nodes);
+
+	top.clear();
+	while (!w.top.empty()) {
+		top.push_back(w.top.top());
+		w.top.pop();
+	}
+	reverse(top.begin(), top.end());
+
+	return total;
+}
+
+UniValue memProfileReport(const UniValue& doc, size_t topN)
+{
+	// before the walk below allocates anything
+	AllocStats st;
+	allocProfileRead(st);
+
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+
+	vector<SubtreeCost> top;
+	size_t total = heaviestSubtrees(doc, topN, top);
+
+	UniValue rep(UniValue::VOBJ);
+	rep.pushKV("allocations", st.allocs);
+	rep.pushKV("frees", st.frees);
+	rep.pushKV("bytes_allocated", st.bytes);
+	if (st.tracksLive) {
+		rep.pushKV("live_heap_bytes", st.live);
+		rep.pushKV("peak_heap_bytes", st.peak);
+	}
+	rep.pushKV("peak_rss_kb", (uint64_t) ru.ru_maxrss);
+	rep.pushKV("document_bytes", (uint64_t) total);
+
+	UniValue list(UniValue::VARR);
+	for (const SubtreeCost& sc : top) {
+		char buf[32];
+		snprintf(buf, sizeof(buf), "%.1f", 100.0 * sc.bytes / total);
+		UniValue pct;
+		pct.setNumStr(buf);
+
+		UniValue obj(UniValue::VOBJ);
+		obj.pushKV("path", sc.path);
+		obj.pushKV("bytes", (uint64_t) sc.bytes);
+		obj.pushKV("percent", pct);
+		obj.pushKV("nodes", (uint64_t) sc.nodes);
+		list.push_back(obj);
+	}
+	rep.pushKV("subtrees", list);
+
+	return rep;
+}
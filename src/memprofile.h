@@ -0,0 +1,27 @@
+#ifndef __MEMPROFILE_H__
+#define __MEMPROFILE_H__
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include "univalue/include/univalue.h"
+
+// Estimated heap held by one subtree of a document: its node, strings
+// and child vectors, by capacity.  Allocator overhead is not counted.
+class SubtreeCost {
+public:
+	std::string	path;		// JSON-PATH of the subtree
+	size_t		bytes;
+	size_t		nodes;
+};
+
+// The topN heaviest subtrees of doc (any value but the root itself),
+// heaviest first.  Returns the estimate for the whole document.
+extern size_t heaviestSubtrees(const UniValue& doc, size_t topN,
+			       std::vector<SubtreeCost>& top);
+
+// --mem-profile report: allocation counts since profiling started,
+// peak RSS, and the topN heaviest subtrees of doc
+extern UniValue memProfileReport(const UniValue& doc, size_t topN);
+
+#endif // __MEMPROFILE_H__
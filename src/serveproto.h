@@ -0,0 +1,22 @@
+#ifndef __SERVEPROTO_H__
+#define __SERVEPROTO_H__
+
+#include <stdint.h>
+
+/*
+ * jup --serve wire protocol, shared by the server and the jupc client.
+ *
+ * Request: header plus SCM_RIGHTS(stdin, stdout, stderr), then a
+ * payload of NUL-terminated strings: cwd, env count, "JUP_*=value"
+ * entries, argv.  Reply: 32-bit exit status.
+ */
+#define JUP_REQ_MAGIC	0x6a757031	/* "jup1" */
+#define JUP_MAX_PAYLOAD	(16 << 20)
+
+struct jupReqHeader {
+	uint32_t	magic;
+	uint32_t	argc;
+	uint32_t	len;
+};
+
+#endif /* __SERVEPROTO_H__ */
@@ -0,0 +1,318 @@
+
+#include "jup-config.h"
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
+#include "server.h"
+#include "serveproto.h"
+
+using namespace std;
+
+extern char **environ;
+
+// this process's own stdin/stdout/stderr, restored after each request
+static int savedFds[3] = { -1, -1, -1 };
+
+// connection whose request is running, for requestExit()
+static int activeConn = -1;
+
+static bool serving = false;
+
+static bool makeAddr(const string& path, struct sockaddr_un& addr)
+{
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (path.size() >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "%s: socket path too long\n", path.c_str());
+		return false;
+	}
+	memcpy(addr.sun_path, path.data(), path.size());
+	return true;
+}
+
+static bool readFull(int fd, void *buf_, size_t len)
+{
+	char *buf = (char *) buf_;
+	while (len > 0) {
+		ssize_t rrc = read(fd, buf, len);
+		if (rrc < 0 && errno == EINTR)
+			continue;
+		if (rrc <= 0)
+			return false;
+		buf += rrc;
+		len -= rrc;
+	}
+	return true;
+}
+
+static bool sendFull(int fd, const void *buf_, size_t len)
+{
+	const char *buf = (const char *) buf_;
+	while (len > 0) {
+		ssize_t wrc = send(fd, buf, len, MSG_NOSIGNAL);
+		if (wrc < 0 && errno == EINTR)
+			continue;
+		if (wrc <= 0)
+			return false;
+		buf += wrc;
+		len -= wrc;
+	}
+	return true;
+}
+
+// exit() inside a request (argp's --help, say) ends this worker.  The
+// client still gets the status; the server starts a replacement.
+static void requestExit(int status, void *)
+{
+	if (activeConn < 0)
+		return;
+
+	fflush(NULL);
+	int32_t st = status;
+	sendFull(activeConn, &st, sizeof(st));
+}
+
+// Replace every JUP_* variable with the client's
+static bool adoptEnv(char *&p, char *end, unsigned long n)
+{
+	vector<string> names;
+	for (char **e = environ; *e; e++)
+		if (!strncmp(*e, "JUP_", 4)) {
+			const char *eq = strchr(*e, '=');
+			if (eq)
+				names.push_back(string(*e, eq - *e));
+		}
+	for (const string& name : names)
+		unsetenv(name.c_str());
+
+	for (; n > 0; n--) {
+		char *kv = p;
+		p += strnlen(p, end - p) + 1;
+		char *eq = (p <= end) ? strchr(kv, '=') : nullptr;
+		if (!eq)
+			return false;
+		*eq = 0;
+		setenv(kv, eq + 1, 1);
+	}
+
+	return true;
+}
+
+static void restoreStdio()
+{
+	fflush(NULL);
+	clearerr(stdin);
+	clearerr(stdout);
+	clearerr(stderr);
+	for (int i = 0; i < 3; i++)
+		dup2(savedFds[i], i);
+}
+
+// Run one request in this process, on the client's stdio
+static int32_t runRequest(int conn, vector<char>& payload, uint32_t argc,
+			  const int fds[3], jupMainFn fn)
+{
+	char *p = payload.data();
+	char *end = p + payload.size();
+	auto nextStr = [&p, end]() -> char * {
+		char *s = p;
+		p += strnlen(p, end - p) + 1;
+		return (p <= end) ? s : nullptr;
+	};
+
+	char *cwd = nextStr();
+	char *envCount = nextStr();
+	if (!cwd || !envCount || chdir(cwd) < 0 ||
+	    !adoptEnv(p, end, strtoul(envCount, NULL, 10)))
+		return 126;
+
+	vector<char *> argv;
+	for (uint32_t i = 0; i < argc; i++) {
+		char *arg = nextStr();
+		if (!arg)
+			return 126;
+		argv.push_back(arg);
+	}
+	argv.push_back(nullptr);
+	if (argc == 0)
+		return 126;
+
+	fflush(NULL);
+	for (int i = 0; i < 3; i++)
+		if (dup2(fds[i], i) < 0) {
+			restoreStdio();
+			return 126;
+		}
+
+	activeConn = conn;
+	int rc = fn(argc, argv.data());
+	activeConn = -1;
+
+	restoreStdio();
+	return rc;
+}
+
+static void handleConn(int conn, jupMainFn fn)
+{
+	jupReqHeader hdr;
+	int fds[3] = { -1, -1, -1 };
+	char cbuf[CMSG_SPACE(sizeof(fds))];
+
+	struct iovec iov = { &hdr, sizeof(hdr) };
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cbuf;
+	msg.msg_controllen = sizeof(cbuf);
+
+	ssize_t rrc;
+	do {
+		rrc = recvmsg(conn, &msg, MSG_CMSG_CLOEXEC);
+	} while (rrc < 0 && errno == EINTR);
+
+	struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+	if (cm && cm->cmsg_level == SOL_SOCKET &&
+	    cm->cmsg_type == SCM_RIGHTS &&
+	    cm->cmsg_len == CMSG_LEN(sizeof(fds)))
+		memcpy(fds, CMSG_DATA(cm), sizeof(fds));
+
+	vector<char> payload;
+	bool ok = (rrc == (ssize_t) sizeof(hdr)) && fds[0] >= 0 &&
+		  hdr.magic == JUP_REQ_MAGIC && hdr.len <= JUP_MAX_PAYLOAD;
+	if (ok) {
+		payload.resize(hdr.len);
+		ok = readFull(conn, payload.data(), payload.size());
+	}
+
+	int32_t status = 126;
+	if (ok)
+		status = runRequest(conn, payload, hdr.argc, fds, fn);
+
+	for (int i = 0; i < 3; i++)
+		if (fds[i] >= 0)
+			close(fds[i]);
+
+	sendFull(conn, &status, sizeof(status));
+	close(conn);
+}
+
+static void workerLoop(int fd, jupMainFn fn)
+{
+#ifdef PR_SET_PDEATHSIG
+	// go when the server does
+	prctl(PR_SET_PDEATHSIG, SIGTERM);
+#endif
+
+	on_exit(requestExit, nullptr);
+
+	while (true) {
+		int conn = accept4(fd, NULL, NULL, SOCK_CLOEXEC);
+		if (conn < 0) {
+			if (errno != EINTR && errno != ECONNABORTED) {
+				perror("accept");
+				sleep(1);
+			}
+			continue;
+		}
+
+		handleConn(conn, fn);
+	}
+}
+
+static pid_t spawnWorker(int fd, jupMainFn fn)
+{
+	pid_t pid = fork();
+	if (pid == 0)
+		workerLoop(fd, fn);
+	else if (pid < 0)
+		perror("fork");
+	return pid;
+}
+
+bool serveRequests(const string& sockPath, unsigned int nWorkers,
+		   jupMainFn fn)
+{
+	if (serving) {
+		fprintf(stderr, "--serve is not available to a server request\n");
+		return false;
+	}
+
+	struct sockaddr_un addr;
+	if (!makeAddr(sockPath, addr))
+		return false;
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		perror("socket");
+		return false;
+	}
+
+	// replace a stale socket, but never any other kind of file
+	struct stat st;
+	if (lstat(sockPath.c_str(), &st) == 0 && S_ISSOCK(st.st_mode))
+		unlink(sockPath.c_str());
+
+	// owner-only access: requests run with the server's privileges
+	mode_t oldMask = umask(0077);
+	int brc = bind(fd, (struct sockaddr *) &addr, sizeof(addr));
+	umask(oldMask);
+
+	if (brc < 0 || listen(fd, 128) < 0) {
+		perror(sockPath.c_str());
+		close(fd);
+		return false;
+	}
+
+	// fds 0-2 stay occupied, so a client's descriptors never land
+	// there and get closed from under the request
+	for (int i = 0; i < 3; i++) {
+		if (fcntl(i, F_GETFD) < 0 &&
+		    open("/dev/null", O_RDWR) != i) {
+			perror("/dev/null");
+			close(fd);
+			return false;
+		}
+		savedFds[i] = fcntl(i, F_DUPFD_CLOEXEC, 3);
+	}
+
+	serving = true;
+
+	unsigned int running = 0;
+	for (unsigned int i = 0; i < nWorkers; i++)
+		if (spawnWorker(fd, fn) > 0)
+			running++;
+
+	// replace workers as they die
+	while (running > 0) {
+		int wstatus;
+		pid_t pid = wait(&wstatus);
+		if (pid < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("wait");
+			break;
+		}
+
+		if (spawnWorker(fd, fn) < 0)
+			running--;
+	}
+
+	close(fd);
+	return false;
+}
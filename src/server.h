@@ -0,0 +1,18 @@
+#ifndef __SERVER_H__
+#define __SERVER_H__
+
+#include <string>
+
+// Runs one jup invocation; returns its exit status.
+typedef int (*jupMainFn)(int argc, char *argv[]);
+
+// Serve requests on a UNIX socket until killed.  nWorkers processes
+// are forked up front, while this process is still single-threaded;
+// each runs its requests one at a time, in-process, with the client's
+// stdin/stdout/stderr, working directory and JUP_* variables.  fn must
+// leave no state behind for the next request.  Returns false if the
+// socket cannot be set up.
+extern bool serveRequests(const std::string& sockPath,
+			  unsigned int nWorkers, jupMainFn fn);
+
+#endif // __SERVER_H__
@@ -0,0 +1,170 @@
+
+#include "jup-config.h"
+#include <stdio.h>
+#include "stats.h"
+
+using namespace std;
+
+class nodeCounts {
+public:
+	uint64_t	objects = 0;
+	uint64_t	arrays = 0;
+	uint64_t	strings = 0;
+	uint64_t	numbers = 0;
+	uint64_t	booleans = 0;
+	uint64_t	nulls = 0;
+	unsigned int	maxDepth = 0;
+};
+
+static void countNodes(const UniValue& val, unsigned int depth,
+		       nodeCounts& nc)
+{
+	if (depth > nc.maxDepth)
+		nc.maxDepth = depth;
+
+	switch (val.getType()) {
+	case UniValue::VOBJ:
+	case UniValue::VARR:
+		if (val.getType() == UniValue::VOBJ)
+			nc.objects++;
+		else
+			nc.arrays++;
+		for (const UniValue& child : val.getValues())
+			countNodes(child, depth + 1, nc);
+		break;
+	case UniValue::VSTR:
+		nc.strings++;
+		break;
+	case UniValue::VNUM:
+		nc.numbers++;
+		break;
+	case UniValue::VBOOL:
+		nc.booleans++;
+		break;
+	case UniValue::VNULL:
+		nc.nulls++;
+		break;
+	}
+}
+
+static UniValue fixedNum(double v, const char *fmt)
+{
+	char buf[32];
+	UniValue num;
+
+	snprintf(buf, sizeof(buf), fmt, v);
+	num.setNumStr(buf);
+	return num;
+}
+
+// wall and CPU time, byte counts and throughput, into obj
+static void putTimes(UniValue& obj, const StatsClock& t, uint64_t bytesIn,
+		     uint64_t bytesOut)
+{
+	obj.pushKV("wall_sec", fixedNum(t.wall, "%.6f"));
+	obj.pushKV("cpu_sec", fixedNum(t.cpu, "%.6f"));
+	obj.pushKV("bytes_in", bytesIn);
+	obj.pushKV("bytes_out", bytesOut);
+
+	uint64_t bytes = bytesIn > bytesOut ? bytesIn : bytesOut;
+	if (bytes > 0 && t.wall > 0)
+		obj.pushKV("mb_per_sec",
+			   fixedNum(bytes / (1024.0 * 1024.0) / t.wall,
+				    "%.1f"));
+}
+
+void JupStats::reset(bool enable)
+{
+	enabled = timePhases = enable;
+	phases.clear();
+	countedIn = countedOut = 0;
+	docInfo.setNull();
+	if (enable)
+		start = StatsClock::now();
+}
+
+void JupStats::add(const StatsPhase& phase)
+{
+	if (timePhases)
+		phases.push_back(phase);
+}
+
+void JupStats::document(const UniValue& doc)
+{
+	if (!enabled)
+		return;
+
+	nodeCounts nc;
+	countNodes(doc, 0, nc);
+
+	docInfo = UniValue(UniValue::VOBJ);
+	docInfo.pushKV("nodes", nc.objects + nc.arrays + nc.strings +
+				nc.numbers + nc.booleans + nc.nulls);
+	docInfo.pushKV("objects", nc.objects);
+	docInfo.pushKV("arrays", nc.arrays);
+	docInfo.pushKV("strings", nc.strings);
+	docInfo.pushKV("numbers", nc.numbers);
+	docInfo.pushKV("booleans", nc.booleans);
+	docInfo.pushKV("nulls", nc.nulls);
+	docInfo.pushKV("max_depth", (uint64_t) nc.maxDepth);
+}
+
+UniValue JupStats::report(int status) const
+{
+	StatsClock total;
+	total.add(start, StatsClock::now());
+
+	uint64_t bytesIn = countedIn, bytesOut = countedOut;
+	for (const StatsPhase& ph : phases) {
+		if (ph.name == "read")
+			bytesIn += ph.bytesIn;
+		else if (ph.name == "output")
+			bytesOut += ph.bytesOut;
+	}
+
+	UniValue rep(UniValue::VOBJ);
+	rep.pushKV("version", VERSION);
+	rep.pushKV("status", status);
+	putTimes(rep, total, bytesIn, bytesOut);
+
+	if (timePhases) {
+		UniValue list(UniValue::VARR);
+		for (const StatsPhase& ph : phases) {
+			UniValue obj(UniValue::VOBJ);
+			obj.pushKV("phase", ph.name);
+			if (!ph.command.empty()) {
+				obj.pushKV("command", ph.command);
+				obj.pushKV("path", ph.path);
+			}
+			putTimes(obj, ph.time, ph.bytesIn, ph.bytesOut);
+			list.push_back(obj);
+		}
+		rep.pushKV("phases", list);
+	}
+
+	if (!docInfo.isNull())
+		rep.pushKV("document", docInfo);
+
+	return rep;
+}
+
+StatsTimer::StatsTimer(JupStats& stats_, const char *name)
+	: stats(stats_), running(stats_.phasesOn())
+{
+	if (!running)
+		return;
+
+	phase.name = name;
+	phase.bytesIn = phase.bytesOut = 0;
+	t0 = StatsClock::now();
+}
+
+void StatsTimer::stop()
+{
+	if (!running)
+		return;
+
+	running = false;
+	phase.time.add(t0, StatsClock::now());
+	stats.add(phase);
+}
@@ -0,0 +1,121 @@
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include <stdint.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include "univalue/include/univalue.h"
+
+// Wall-clock and process CPU time, in seconds
+class StatsClock {
+public:
+	double	wall;
+	double	cpu;
+
+	StatsClock() : wall(0), cpu(0) {}
+
+	static StatsClock now() {
+		struct timespec ts;
+		StatsClock c;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		c.wall = ts.tv_sec + ts.tv_nsec / 1e9;
+		clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+		c.cpu = ts.tv_sec + ts.tv_nsec / 1e9;
+		return c;
+	}
+
+	void add(const StatsClock& from, const StatsClock& to) {
+		wall += to.wall - from.wall;
+		cpu += to.cpu - from.cpu;
+	}
+};
+
+class StatsPhase {
+public:
+	std::string	name;
+	std::string	command;	// "command" phases only
+	std::string	path;
+	StatsClock	time;
+	uint64_t	bytesIn;
+	uint64_t	bytesOut;
+};
+
+// Per-run timing report for --stats: totals for the whole run, plus
+// phases (read, parse or index, each command, serialize, output) where
+// the run takes a single-document path.  Input and output totals are
+// the sums over "read" and "output" phases, plus bytes counted by
+// modes that report totals only.
+class JupStats {
+private:
+	bool			enabled;
+	bool			timePhases;
+	StatsClock		start;
+	std::vector<StatsPhase>	phases;
+	uint64_t		countedIn;
+	uint64_t		countedOut;
+	UniValue		docInfo;
+
+public:
+	JupStats() : enabled(false), timePhases(false), countedIn(0),
+		countedOut(0) {}
+
+	// Start a run, clearing any earlier one
+	void reset(bool enable);
+
+	bool on() const { return enabled; }
+	bool phasesOn() const { return timePhases; }
+
+	// Report totals only.  For modes whose work is spread over
+	// threads or files.
+	void totalsOnly() { timePhases = false; }
+
+	void add(const StatsPhase& phase);
+
+	// Input and output bytes outside any phase
+	void count(uint64_t in, uint64_t out) {
+		countedIn += in;
+		countedOut += out;
+	}
+
+	// Record node counts of the final document
+	void document(const UniValue& doc);
+
+	UniValue report(int status) const;
+};
+
+// Times a phase from construction to stop() or destruction.  Does
+// nothing unless phase timing is on.
+class StatsTimer {
+private:
+	JupStats&	stats;
+	StatsClock	t0;
+	StatsPhase	phase;
+	bool		running;
+
+public:
+	StatsTimer(JupStats& stats_, const char *name);
+	~StatsTimer() { stop(); }
+
+	StatsTimer(const StatsTimer&) = delete;
+	StatsTimer& operator=(const StatsTimer&) = delete;
+
+	void command(const std::string& cmd, const std::string& path) {
+		phase.command = cmd;
+		phase.path = path;
+	}
+	void bytes(uint64_t in, uint64_t out) {
+		phase.bytesIn = in;
+		phase.bytesOut = out;
+	}
+
+	// leave out time accounted to another phase
+	void exclude(const StatsClock& t) {
+		phase.time.wall -= t.wall;
+		phase.time.cpu -= t.cpu;
+	}
+
+	void stop();
+};
+
+#endif // __STATS_H__
@@ -0,0 +1,61 @@
+
+#include "jup-config.h"
+#include "threadpool.h"
+
+using namespace std;
+
+ThreadPool::ThreadPool(unsigned int nThreads)
+	: stopping(false)
+{
+	if (nThreads == 0)
+		nThreads = 1;
+
+	for (unsigned int i = 0; i < nThreads; i++)
+		workers.emplace_back(&ThreadPool::workerLoop, this);
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		unique_lock<mutex> lk(lock);
+		stopping = true;
+	}
+	cond.notify_all();
+
+	for (thread& t : workers)
+		t.join();
+}
+
+void ThreadPool::push(function<void()> job)
+{
+	{
+		unique_lock<mutex> lk(lock);
+		jobs.push_back(move(job));
+	}
+	cond.notify_one();
+}
+
+void ThreadPool::workerLoop()
+{
+	while (1) {
+		function<void()> job;
+
+		{
+			unique_lock<mutex> lk(lock);
+			cond.wait(lk, [this] { return stopping || !jobs.empty(); });
+			if (jobs.empty())
+				return;		// stopping, and queue drained
+
+			job = move(jobs.front());
+			jobs.pop_front();
+		}
+
+		job();
+	}
+}
+
+unsigned int defaultThreadCount()
+{
+	unsigned int n = thread::hardware_concurrency();
+	return n ? n : 1;
+}
@@ -0,0 +1,36 @@
+#ifndef __THREADPOOL_H__
+#define __THREADPOOL_H__
+
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+// Fixed-size pool of worker threads pulling jobs from a FIFO queue.
+class ThreadPool {
+private:
+	std::vector<std::thread>		workers;
+	std::deque<std::function<void()>>	jobs;
+	std::mutex				lock;
+	std::condition_variable			cond;
+	bool					stopping;
+
+	void workerLoop();
+
+public:
+	explicit ThreadPool(unsigned int nThreads);
+	~ThreadPool();		// drains queued jobs, then joins
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	void push(std::function<void()> job);
+	size_t size() const { return workers.size(); }
+};
+
+// Number of workers to use when the user requests "auto" (0)
+extern unsigned int defaultThreadCount();
+
+#endif // __THREADPOOL_H__
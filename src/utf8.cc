@@ -0,0 +1,264 @@
+
+#include "jup-config.h"
+#include <stdint.h>
+#include <string.h>
+#include "utf8.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define UTF8_X86 1
+#include <immintrin.h>
+#endif
+
+// multibyte decode from
+// https://stackoverflow.com/questions/28270310/how-to-easily-detect-utf8-encoding-in-the-string
+static bool validateScalar(const char *s, size_t len)
+{
+	const unsigned char *bytes = (const unsigned char *) s;
+	const unsigned char *end = bytes + len;
+	unsigned int cp;
+	int num;
+
+	while (bytes < end) {
+		// ASCII fast path, a word at a time
+		while (end - bytes >= 8) {
+			uint64_t w;
+			memcpy(&w, bytes, sizeof(w));
+			if (w & 0x8080808080808080ULL)
+				break;
+			bytes += 8;
+		}
+		if (bytes == end)
+			break;
+
+		if ((*bytes & 0x80) == 0x00) {
+			bytes += 1;
+			continue;
+		} else if ((*bytes & 0xE0) == 0xC0) {
+			cp = (*bytes & 0x1F);
+			num = 2;
+		} else if ((*bytes & 0xF0) == 0xE0) {
+			cp = (*bytes & 0x0F);
+			num = 3;
+		} else if ((*bytes & 0xF8) == 0xF0) {
+			cp = (*bytes & 0x07);
+			num = 4;
+		} else
+			return false;
+
+		if (end - bytes < num)
+			return false;
+
+		bytes += 1;
+		for (int i = 1; i < num; ++i) {
+			if ((*bytes & 0xC0) != 0x80)
+				return false;
+			cp = (cp << 6) | (*bytes & 0x3F);
+			bytes += 1;
+		}
+
+		if ((cp > 0x10FFFF) ||
+		    ((cp >= 0xD800) && (cp <= 0xDFFF)) ||
+		    ((cp <= 0x007F) && (num != 1)) ||
+		    ((cp >= 0x0080) && (cp <= 0x07FF) && (num != 2)) ||
+		    ((cp >= 0x0800) && (cp <= 0xFFFF) && (num != 3)) ||
+		    ((cp >= 0x10000) && (cp <= 0x1FFFFF) && (num != 4)))
+			return false;
+	}
+
+	return true;
+}
+
+#ifdef UTF8_X86
+
+// Lookup-table validator from John Keiser and Daniel Lemire,
+// "Validating UTF-8 In Less Than One Instruction Per Byte" (2021).
+// Each byte pair (prev1, cur) is classified by three 16-entry tables
+// indexed by nibble; any bit surviving the AND is an error, except
+// that the 0x80 bit must line up with the 3rd/4th bytes of a sequence.
+
+enum {
+	TOO_SHORT	= 1 << 0,	// lead not followed by continuation
+	TOO_LONG	= 1 << 1,	// ASCII followed by continuation
+	OVERLONG_3	= 1 << 2,
+	TOO_LARGE	= 1 << 3,
+	SURROGATE	= 1 << 4,
+	OVERLONG_2	= 1 << 5,
+	TOO_LARGE_1000	= 1 << 6,
+	OVERLONG_4	= 1 << 6,
+	TWO_CONTS	= 1 << 7,	// continuation after continuation
+	CARRY		= TOO_SHORT | TOO_LONG | TWO_CONTS,
+};
+
+#define LUT16(...) _mm256_setr_epi8(__VA_ARGS__, __VA_ARGS__)
+
+// bytes of (prev:cur) shifted so lane i holds byte i-n
+__attribute__((target("avx2")))
+static inline __m256i prevBytes(__m256i cur, __m256i prev, int n)
+{
+	__m256i t = _mm256_permute2x128_si256(prev, cur, 0x21);
+	switch (n) {
+	case 1: return _mm256_alignr_epi8(cur, t, 15);
+	case 2: return _mm256_alignr_epi8(cur, t, 14);
+	default: return _mm256_alignr_epi8(cur, t, 13);
+	}
+}
+
+__attribute__((target("avx2")))
+static inline __m256i checkBlock(__m256i cur, __m256i prev)
+{
+	const __m256i nib = _mm256_set1_epi8(0x0f);
+	const __m256i byte1High = LUT16(
+		TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+		TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+		TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+		TOO_SHORT | OVERLONG_2,
+		TOO_SHORT,
+		TOO_SHORT | OVERLONG_3 | SURROGATE,
+		TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4);
+	const __m256i byte1Low = LUT16(
+		CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4,
+		CARRY | OVERLONG_2,
+		CARRY,
+		CARRY,
+		CARRY | TOO_LARGE,
+		CARRY | TOO_LARGE | TOO_LARGE_1000,
+		CARRY | TOO_LARGE | TOO_LARGE_1000,
+		CARRY | TOO_LARGE | TOO_LARGE_1000,
+		CARRY | TOO_LARGE | TOO_LARGE_1000,
+		CARRY | TOO_LARGE | TOO_LARGE_1000,
+		CARRY | TOO_LARGE | TOO_LARGE_1000,
+		CARRY | TOO_LARGE | TOO_LARGE_1000,
+		CARRY | TOO_LARGE | TOO_LARGE_1000,
+		CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,
+		CARRY | TOO_LARGE | TOO_LARGE_1000,
+		CARRY | TOO_LARGE | TOO_LARGE_1000);
+	const __m256i byte2High = LUT16(
+		TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+		TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+		TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 |
+			TOO_LARGE_1000 | OVERLONG_4,
+		TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,
+		TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+		TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+		TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT);
+
+	__m256i prev1 = prevBytes(cur, prev, 1);
+	__m256i sc = _mm256_and_si256(
+		_mm256_and_si256(
+			_mm256_shuffle_epi8(byte1High, _mm256_and_si256(
+				_mm256_srli_epi16(prev1, 4), nib)),
+			_mm256_shuffle_epi8(byte1Low,
+				_mm256_and_si256(prev1, nib))),
+		_mm256_shuffle_epi8(byte2High, _mm256_and_si256(
+			_mm256_srli_epi16(cur, 4), nib)));
+
+	// 3rd and 4th bytes of a sequence must be continuations
+	__m256i third = _mm256_subs_epu8(prevBytes(cur, prev, 2),
+					 _mm256_set1_epi8(0xe0u - 0x80));
+	__m256i fourth = _mm256_subs_epu8(prevBytes(cur, prev, 3),
+					  _mm256_set1_epi8(0xf0u - 0x80));
+	__m256i must23 = _mm256_and_si256(_mm256_or_si256(third, fourth),
+					  _mm256_set1_epi8((char) 0x80));
+
+	return _mm256_xor_si256(must23, sc);
+}
+
+// nonzero if the block ends inside a multibyte sequence
+__attribute__((target("avx2")))
+static inline __m256i incompleteAtEnd(__m256i cur)
+{
+	const __m256i maxValue = _mm256_setr_epi8(
+		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		(char)(0xf0u - 1), (char)(0xe0u - 1), (char)(0xc0u - 1));
+	return _mm256_subs_epu8(cur, maxValue);
+}
+
+__attribute__((target("avx2")))
+static bool validateAVX2(const char *s, size_t len)
+{
+	__m256i prev = _mm256_setzero_si256();
+	__m256i prevIncomplete = _mm256_setzero_si256();
+	__m256i error = _mm256_setzero_si256();
+	size_t i = 0;
+
+	for (; len - i >= 32; i += 32) {
+		// skip ASCII runs 64 bytes at a time
+		while (len - i >= 64) {
+			__m256i a = _mm256_loadu_si256((const __m256i *)(s + i));
+			__m256i b = _mm256_loadu_si256(
+				(const __m256i *)(s + i + 32));
+			if (_mm256_movemask_epi8(_mm256_or_si256(a, b)))
+				break;
+			error = _mm256_or_si256(error, prevIncomplete);
+			prevIncomplete = _mm256_setzero_si256();
+			prev = b;
+			i += 64;
+		}
+		if (len - i < 32)
+			break;
+
+		__m256i cur = _mm256_loadu_si256((const __m256i *)(s + i));
+
+		if (_mm256_movemask_epi8(cur) == 0) {
+			// ASCII: only a sequence cut off at the boundary fails
+			error = _mm256_or_si256(error, prevIncomplete);
+			prevIncomplete = _mm256_setzero_si256();
+		} else {
+			error = _mm256_or_si256(error, checkBlock(cur, prev));
+			prevIncomplete = incompleteAtEnd(cur);
+		}
+		prev = cur;
+
+		// bail out early on bad input, but not on every block
+		if ((i & 4095) == 4064 && !_mm256_testz_si256(error, error))
+			return false;
+	}
+
+	// zero-padded tail; the padding ends any open sequence
+	if (i < len) {
+		char tail[32] = {};
+		memcpy(tail, s + i, len - i);
+		__m256i cur = _mm256_loadu_si256((const __m256i *) tail);
+		error = _mm256_or_si256(error, checkBlock(cur, prev));
+	} else
+		error = _mm256_or_si256(error, prevIncomplete);
+
+	return _mm256_testz_si256(error, error);
+}
+
+#endif // UTF8_X86
+
+static const utf8Kernel kernels[] = {
+	{ "scalar", validateScalar },
+#ifdef UTF8_X86
+	{ "avx2", validateAVX2 },
+#endif
+};
+
+const utf8Kernel *utf8KernelList(size_t& count)
+{
+	static const size_t nUsable = [] {
+		size_t n = sizeof(kernels) / sizeof(kernels[0]);
+#ifdef UTF8_X86
+		__builtin_cpu_init();
+		if (!__builtin_cpu_supports("avx2"))
+			n--;
+#endif
+		return n;
+	}();
+
+	count = nUsable;
+	return kernels;
+}
+
+const utf8Kernel& utf8ActiveKernel()
+{
+	static const utf8Kernel *active = [] {
+		size_t n;
+		const utf8Kernel *list = utf8KernelList(n);
+		return &list[n - 1];
+	}();
+
+	return *active;
+}
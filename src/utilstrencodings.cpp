@@ -4,6 +4,8 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "utilstrencodings.h"
+#include "b64codec.h"
+#include "hexcodec.h"
 
 #include <cstdlib>
 #include <cstring>
@@ -58,24 +60,46 @@ bool IsHexNumber(const std::string& str)
     return (str.size() > starting_location);
 }
 
-std::vector<unsigned char> ParseHex(const char* psz)
+size_t ParseHexLength(const char* p, const char* pend)
 {
-    // convert hex dump to vector
-    std::vector<unsigned char> vch;
+    size_t n = 0;
     while (true)
     {
-        while (isspace(*psz))
-            psz++;
-        signed char c = HexDigit(*psz++);
-        if (c == (signed char)-1)
+        while (p < pend && isspace(*p))
+            p++;
+        size_t k = hexDecode(p, pend - p, nullptr, (size_t)-1);
+        if (k == 0)
             break;
-        unsigned char n = (c << 4);
-        c = HexDigit(*psz++);
-        if (c == (signed char)-1)
+        p += k * 2;
+        n += k;
+    }
+    return n;
+}
+
+size_t ParseHexChunk(const char*& p, const char* pend, unsigned char* out, size_t outLen)
+{
+    size_t n = 0;
+    while (n < outLen)
+    {
+        while (p < pend && isspace(*p))
+            p++;
+        // vectorized run of whitespace-free pairs
+        size_t k = hexDecode(p, pend - p, out + n, outLen - n);
+        if (k == 0)
             break;
-        n |= c;
-        vch.push_back(n);
+        p += k * 2;
+        n += k;
     }
+    return n;
+}
+
+std::vector<unsigned char> ParseHex(const char* psz)
+{
+    // convert hex dump to vector
+    const char* pend = psz + strlen(psz);
+    std::vector<unsigned char> vch(ParseHexLength(psz, pend));
+    if (!vch.empty())
+        ParseHexChunk(psz, pend, vch.data(), vch.size());
     return vch;
 }
 
@@ -84,49 +108,22 @@ std::vector<unsigned char> ParseHex(const std::string& str)
     return ParseHex(str.c_str());
 }
 
-std::string EncodeBase64(const unsigned char* pch, size_t len)
+std::string HexStr(const unsigned char* itbegin, const unsigned char* itend, bool fSpaces)
 {
-    static const char *pbase64 = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
-
-    std::string strRet = "";
-    strRet.reserve((len+2)/3*4);
-
-    int mode=0, left=0;
-    const unsigned char *pchEnd = pch+len;
-
-    while (pch<pchEnd)
-    {
-        int enc = *(pch++);
-        switch (mode)
-        {
-            case 0: // we have no bits
-                strRet += pbase64[enc >> 2];
-                left = (enc & 3) << 4;
-                mode = 1;
-                break;
-
-            case 1: // we have two bits
-                strRet += pbase64[left | (enc >> 4)];
-                left = (enc & 15) << 2;
-                mode = 2;
-                break;
-
-            case 2: // we have four bits
-                strRet += pbase64[left | (enc >> 6)];
-                strRet += pbase64[enc & 63];
-                mode = 0;
-                break;
-        }
-    }
+    if (fSpaces)
+        return HexStr<const unsigned char*>(itbegin, itend, fSpaces);
 
-    if (mode)
-    {
-        strRet += pbase64[left];
-        strRet += '=';
-        if (mode == 1)
-            strRet += '=';
-    }
+    std::string rv((itend - itbegin) * 2, '\0');
+    if (!rv.empty())
+        hexEncode(itbegin, itend - itbegin, &rv[0]);
+    return rv;
+}
 
+std::string EncodeBase64(const unsigned char* pch, size_t len)
+{
+    std::string strRet(b64EncodedSize(len), '\0');
+    if (len)
+        b64ActiveKernel().encode(pch, len, &strRet[0]);
     return strRet;
 }
 
@@ -135,67 +132,36 @@ std::string EncodeBase64(const std::string& str)
     return EncodeBase64((const unsigned char*)str.c_str(), str.size());
 }
 
-std::vector<unsigned char> DecodeBase64(const char* p, bool* pfInvalid)
+static const int decode64_table[256] =
 {
-    static const int decode64_table[256] =
-    {
-        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
-        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
-        -1, -1, -1, 62, -1, -1, -1, 63, 52, 53, 54, 55, 56, 57, 58, 59, 60, 61, -1, -1,
-        -1, -1, -1, -1, -1,  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14,
-        15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, -1, -1, -1, -1, -1, -1, 26, 27, 28,
-        29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40, 41, 42, 43, 44, 45, 46, 47, 48,
-        49, 50, 51, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
-        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
-        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
-        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
-        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
-        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
-        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1
-    };
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, 62, -1, -1, -1, 63, 52, 53, 54, 55, 56, 57, 58, 59, 60, 61, -1, -1,
+    -1, -1, -1, -1, -1,  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14,
+    15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, -1, -1, -1, -1, -1, -1, 26, 27, 28,
+    29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40, 41, 42, 43, 44, 45, 46, 47, 48,
+    49, 50, 51, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1
+};
+
+size_t DecodeBase64Length(const char* p, size_t len, bool* pfInvalid)
+{
+    size_t n = b64ActiveKernel().scan(p, len);
 
     if (pfInvalid)
-        *pfInvalid = false;
-
-    std::vector<unsigned char> vchRet;
-    vchRet.reserve(strlen(p)*3/4);
-
-    int mode = 0;
-    int left = 0;
-
-    while (1)
     {
-         int dec = decode64_table[(unsigned char)*p];
-         if (dec == -1) break;
-         p++;
-         switch (mode)
-         {
-             case 0: // we have no bits and get 6
-                 left = dec;
-                 mode = 1;
-                 break;
-
-              case 1: // we have 6 bits and keep 4
-                  vchRet.push_back((left<<2) | (dec>>4));
-                  left = dec & 15;
-                  mode = 2;
-                  break;
-
-             case 2: // we have 4 bits and get 6, we keep 2
-                 vchRet.push_back((left<<4) | (dec>>2));
-                 left = dec & 3;
-                 mode = 3;
-                 break;
-
-             case 3: // we have 2 bits and get 6
-                 vchRet.push_back((left<<6) | dec);
-                 mode = 0;
-                 break;
-         }
-    }
+        *pfInvalid = false;
 
-    if (pfInvalid)
-        switch (mode)
+        // bytes past the end read as NUL, which is never base64
+        const char* q = p + n;
+        size_t rem = len - n;
+        int left = (n > 0) ? decode64_table[(unsigned char)p[n-1]] : 0;
+        switch (n % 4)
         {
             case 0: // 4n base64 characters processed: ok
                 break;
@@ -205,16 +171,33 @@ std::vector<unsigned char> DecodeBase64(const char* p, bool* pfInvalid)
                 break;
 
             case 2: // 4n+2 base64 characters processed: require '=='
-                if (left || p[0] != '=' || p[1] != '=' || decode64_table[(unsigned char)p[2]] != -1)
+                if ((left & 15) || rem < 2 || q[0] != '=' || q[1] != '=' ||
+                    (rem > 2 && decode64_table[(unsigned char)q[2]] != -1))
                     *pfInvalid = true;
                 break;
 
             case 3: // 4n+3 base64 characters processed: require '='
-                if (left || p[0] != '=' || decode64_table[(unsigned char)p[1]] != -1)
+                if ((left & 3) || rem < 1 || q[0] != '=' ||
+                    (rem > 1 && decode64_table[(unsigned char)q[1]] != -1))
                     *pfInvalid = true;
                 break;
         }
+    }
+
+    return n;
+}
+
+size_t DecodeBase64Block(const char* p, size_t len, unsigned char* out)
+{
+    return b64ActiveKernel().decode(p, len, out);
+}
 
+std::vector<unsigned char> DecodeBase64(const char* p, bool* pfInvalid)
+{
+    size_t n = DecodeBase64Length(p, strlen(p), pfInvalid);
+    std::vector<unsigned char> vchRet(n * 3 / 4);
+    if (n)
+        DecodeBase64Block(p, n, vchRet.data());
     return vchRet;
 }
 
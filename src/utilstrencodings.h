@@ -21,6 +21,10 @@
 
 std::vector<unsigned char> ParseHex(const char* psz);
 std::vector<unsigned char> ParseHex(const std::string& str);
+/** Number of bytes ParseHex() would decode from [p, pend). */
+size_t ParseHexLength(const char* p, const char* pend);
+/** Decode up to outLen bytes as ParseHex() does, advancing p past them. */
+size_t ParseHexChunk(const char*& p, const char* pend, unsigned char* out, size_t outLen);
 signed char HexDigit(char c);
 /* Returns true if each character in str is a hex character, and has an even
  * number of hex digits.*/
@@ -31,6 +35,10 @@ bool IsHex(const std::string& str);
 bool IsHexNumber(const std::string& str);
 std::vector<unsigned char> DecodeBase64(const char* p, bool* pfInvalid = nullptr);
 std::string DecodeBase64(const std::string& str);
+/** Length of the leading base64 run in p, with DecodeBase64()'s padding check. */
+size_t DecodeBase64Length(const char* p, size_t len, bool* pfInvalid = nullptr);
+/** Decode len base64 characters, all known valid, into out.  Returns bytes written. */
+size_t DecodeBase64Block(const char* p, size_t len, unsigned char* out);
 std::string EncodeBase64(const unsigned char* pch, size_t len);
 std::string EncodeBase64(const std::string& str);
 
@@ -40,7 +48,7 @@ std::string HexStr(const T itbegin, const T itend, bool fSpaces=false)
     std::string rv;
     static const char hexmap[16] = { '0', '1', '2', '3', '4', '5', '6', '7',
                                      '8', '9', 'a', 'b', 'c', 'd', 'e', 'f' };
-    rv.reserve((itend-itbegin)*3);
+    rv.reserve((itend-itbegin)*(fSpaces ? 3 : 2));
     for(T it = itbegin; it < itend; ++it)
     {
         unsigned char val = (unsigned char)(*it);
@@ -53,6 +61,9 @@ std::string HexStr(const T itbegin, const T itend, bool fSpaces=false)
     return rv;
 }
 
+/** Contiguous bytes take the vectorized path when fSpaces is false. */
+std::string HexStr(const unsigned char* itbegin, const unsigned char* itend, bool fSpaces=false);
+
 template<typename T>
 inline std::string HexStr(const T& vch, bool fSpaces=false)
 {
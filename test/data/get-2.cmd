@@ -0,0 +1 @@
+get quiz.maths.q2.options.3
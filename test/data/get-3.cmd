@@ -0,0 +1 @@
+get quiz.sport get q1.question.deep
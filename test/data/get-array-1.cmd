@@ -0,0 +1 @@
+get.array quiz.sport.q1.answer,quiz.maths.q1.options.2,quiz.nope
@@ -0,0 +1 @@
+get quiz get.object maths.q2.answer,sport.q1.options,maths.q2.answer
@@ -0,0 +1 @@
+get quiz.sport.q1.options.1:3
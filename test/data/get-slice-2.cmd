@@ -0,0 +1 @@
+-- get quiz.maths.q1.options.::-2